@@ -818,7 +818,7 @@ internal class CAdapterGenerator(
         |
         |extern "C" {
         |void UpdateRef(KObjHeader**, const KObjHeader*) RUNTIME_NOTHROW;
-        |KObjHeader* AllocInstance(const KTypeInfo*, KObjHeader**) RUNTIME_NOTHROW;
+        |KObjHeader* AllocInstance(const KTypeInfo*, KObjHeader**);
         |KObjHeader* DerefStablePointer(void*, KObjHeader**) RUNTIME_NOTHROW;
         |void* CreateStablePointer(KObjHeader*) RUNTIME_NOTHROW;
         |void DisposeStablePointer(void*) RUNTIME_NOTHROW;
@@ -191,6 +191,12 @@ internal class FunctionGenerationContext(val function: LLVMValueRef,
     private var localAllocs = 0
     private var arenaSlot: LLVMValueRef? = null
     private val slotToVariableLocation = mutableMapOf<Int,VariableDebugLocation>()
+    // Slots of local variables, references from which are not counted.
+    private var deferredSlotsPhi: LLVMValueRef? = null
+    // Header slots of deferred frame are reserved for runtime, see EnterDeferredFrame().
+    private val deferredFrameHeaderSlotCount = 2
+    private var deferredSlotCount = deferredFrameHeaderSlotCount
+    private val deferredSlotToVariableLocation = mutableMapOf<Int,VariableDebugLocation>()
 
     private val prologueBb        = basicBlockInFunction("prologue", startLocation)
     private val localsInitBb      = basicBlockInFunction("locals_init", startLocation)
@@ -225,9 +231,18 @@ internal class FunctionGenerationContext(val function: LLVMValueRef,
         return result
     }
 
-    fun alloca(type: LLVMTypeRef?, name: String = "", variableLocation: VariableDebugLocation? = null): LLVMValueRef {
+    fun alloca(type: LLVMTypeRef?, name: String = "", variableLocation: VariableDebugLocation? = null,
+               deferred: Boolean = false): LLVMValueRef {
         if (isObjectType(type!!)) {
             appendingTo(localsInitBb) {
+                if (deferred) {
+                    val slotAddress = gep(deferredSlotsPhi!!, Int32(deferredSlotCount).llvm, name)
+                    variableLocation?.let {
+                        deferredSlotToVariableLocation[deferredSlotCount] = it
+                    }
+                    deferredSlotCount++
+                    return slotAddress
+                }
                 val slotAddress = gep(slotsPhi!!, Int32(slotCount).llvm, name)
                 variableLocation?.let {
                     slotToVariableLocation[slotCount] = it
@@ -280,8 +295,8 @@ internal class FunctionGenerationContext(val function: LLVMValueRef,
     fun loadSlot(address: LLVMValueRef, isVar: Boolean, name: String = ""): LLVMValueRef {
         val value = LLVMBuildLoad(builder, address, name)!!
         if (isObjectRef(value) && isVar) {
-            val slot = alloca(LLVMTypeOf(value), variableLocation = null)
-            storeAny(value, slot)
+            val slot = alloca(LLVMTypeOf(value), variableLocation = null, deferred = true)
+            storeStackRef(value, slot)
         }
         return value
     }
@@ -300,6 +315,15 @@ internal class FunctionGenerationContext(val function: LLVMValueRef,
         }
     }
 
+    // Stores to the slot allocated with `alloca(deferred = true)`.
+    fun storeStackRef(value: LLVMValueRef, ptr: LLVMValueRef) {
+        if (isObjectRef(value)) {
+            call(context.llvm.updateStackRefFunction, listOf(ptr, value))
+        } else {
+            LLVMBuildStore(builder, value, ptr)
+        }
+    }
+
     private fun updateReturnRef(value: LLVMValueRef, address: LLVMValueRef) {
         call(context.llvm.updateReturnRefFunction, listOf(address, value))
     }
@@ -406,16 +430,16 @@ internal class FunctionGenerationContext(val function: LLVMValueRef,
         }
     }
 
-    fun allocInstance(typeInfo: LLVMValueRef, lifetime: Lifetime): LLVMValueRef {
-        return call(context.llvm.allocInstanceFunction, listOf(typeInfo), lifetime)
+    fun allocInstance(typeInfo: LLVMValueRef, lifetime: Lifetime, exceptionHandler: ExceptionHandler): LLVMValueRef {
+        return call(context.llvm.allocInstanceFunction, listOf(typeInfo), lifetime, exceptionHandler)
     }
 
-    fun allocInstance(descriptor: ClassDescriptor, lifetime: Lifetime): LLVMValueRef =
-            allocInstance(codegen.typeInfoForAllocation(descriptor), lifetime)
+    fun allocInstance(descriptor: ClassDescriptor, lifetime: Lifetime, exceptionHandler: ExceptionHandler): LLVMValueRef =
+            allocInstance(codegen.typeInfoForAllocation(descriptor), lifetime, exceptionHandler)
 
-    fun allocArray(
-            typeInfo: LLVMValueRef, count: LLVMValueRef, lifetime: Lifetime): LLVMValueRef {
-        return call(context.llvm.allocArrayFunction, listOf(typeInfo, count), lifetime)
+    fun allocArray(typeInfo: LLVMValueRef, count: LLVMValueRef, lifetime: Lifetime,
+                   exceptionHandler: ExceptionHandler): LLVMValueRef {
+        return call(context.llvm.allocArrayFunction, listOf(typeInfo, count), lifetime, exceptionHandler)
     }
 
     fun unreachable(): LLVMValueRef? {
@@ -816,6 +840,7 @@ internal class FunctionGenerationContext(val function: LLVMValueRef,
         }
         positionAtEnd(localsInitBb)
         slotsPhi = phi(kObjHeaderPtrPtr)
+        deferredSlotsPhi = phi(kObjHeaderPtrPtr)
         // Is removed by DCE trivially, if not needed.
         arenaSlot = intToPtr(
                 or(ptrToInt(slotsPhi, codegen.intPtrType), codegen.immOneIntPtrType), kObjHeaderPtrPtr)
@@ -839,20 +864,22 @@ internal class FunctionGenerationContext(val function: LLVMValueRef,
                 call(context.llvm.enterFrameFunction, listOf(slots, Int32(vars.skip).llvm, Int32(slotCount).llvm))
             }
             addPhiIncoming(slotsPhi!!, prologueBb to slots)
-            memScoped {
-                slotToVariableLocation.forEach { slot, variable ->
-                    val expr = longArrayOf(DwarfOp.DW_OP_plus_uconst.value,
-                            runtime.pointerSize * slot.toLong()).toCValues()
-                    DIInsertDeclaration(
-                            builder       = codegen.context.debugInfo.builder,
-                            value         = slots,
-                            localVariable = variable.localVariable,
-                            location      = variable.location,
-                            bb            = prologueBb,
-                            expr          = expr,
-                            exprCount     = 2)
-                }
+            val deferredSlots = if (needDeferredSlots)
+                LLVMBuildArrayAlloca(builder, kObjHeaderPtr, Int32(deferredSlotCount).llvm, "")!!
+            else
+                kNullObjHeaderPtrPtr
+            if (needDeferredSlots) {
+                val deferredSlotsMem = bitcast(kInt8Ptr, deferredSlots)
+                call(context.llvm.memsetFunction,
+                        listOf(deferredSlotsMem, Int8(0).llvm,
+                                Int32(deferredSlotCount * codegen.runtime.pointerSize).llvm,
+                                Int32(codegen.runtime.pointerAlignment).llvm,
+                                Int1(0).llvm))
+                call(context.llvm.enterDeferredFrameFunction, listOf(deferredSlots, Int32(deferredSlotCount).llvm))
             }
+            addPhiIncoming(deferredSlotsPhi!!, prologueBb to deferredSlots)
+            declareSlotVariables(slots, slotToVariableLocation)
+            declareSlotVariables(deferredSlots, deferredSlotToVariableLocation)
             br(localsInitBb)
         }
 
@@ -927,6 +954,24 @@ internal class FunctionGenerationContext(val function: LLVMValueRef,
         vars.clear()
         returnSlot = null
         slotsPhi = null
+        deferredSlotsPhi = null
+    }
+
+    private fun declareSlotVariables(slots: LLVMValueRef, slotToVariableLocation: Map<Int, VariableDebugLocation>) {
+        memScoped {
+            slotToVariableLocation.forEach { slot, variable ->
+                val expr = longArrayOf(DwarfOp.DW_OP_plus_uconst.value,
+                        runtime.pointerSize * slot.toLong()).toCValues()
+                DIInsertDeclaration(
+                        builder       = codegen.context.debugInfo.builder,
+                        value         = slots,
+                        localVariable = variable.localVariable,
+                        location      = variable.location,
+                        bb            = prologueBb,
+                        expr          = expr,
+                        exprCount     = 2)
+            }
+        }
     }
 
     //-------------------------------------------------------------------------//
@@ -1026,11 +1071,18 @@ internal class FunctionGenerationContext(val function: LLVMValueRef,
             return slotCount > frameOverlaySlotCount || localAllocs > 0
         }
 
+    private val needDeferredSlots: Boolean
+        get() = deferredSlotCount > deferredFrameHeaderSlotCount
+
     private fun releaseVars() {
         if (needSlots) {
             call(context.llvm.leaveFrameFunction,
                     listOf(slotsPhi!!, Int32(vars.skip).llvm, Int32(slotCount).llvm))
         }
+        if (needDeferredSlots) {
+            call(context.llvm.leaveDeferredFrameFunction,
+                    listOf(deferredSlotsPhi!!, Int32(deferredSlotCount).llvm))
+        }
     }
 }
 
@@ -410,8 +410,12 @@ internal class Llvm(val context: Context, val llvmModule: LLVMModuleRef) {
     val initSharedInstanceFunction = importRtFunction("InitSharedInstance")
     val updateReturnRefFunction = importRtFunction("UpdateReturnRef")
     val updateRefFunction = importRtFunction("UpdateRef")
+    val registerGlobalRootFunction = importRtFunction("RegisterGlobalRoot")
     val enterFrameFunction = importRtFunction("EnterFrame")
     val leaveFrameFunction = importRtFunction("LeaveFrame")
+    val updateStackRefFunction = importRtFunction("UpdateStackRef")
+    val enterDeferredFrameFunction = importRtFunction("EnterDeferredFrame")
+    val leaveDeferredFrameFunction = importRtFunction("LeaveDeferredFrame")
     val getReturnSlotIfArenaFunction = importRtFunction("GetReturnSlotIfArena")
     val getParamSlotIfArenaFunction = importRtFunction("GetParamSlotIfArena")
     val lookupOpenMethodFunction = importRtFunction("LookupOpenMethod")
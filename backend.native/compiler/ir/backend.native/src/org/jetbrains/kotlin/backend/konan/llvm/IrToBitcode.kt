@@ -392,6 +392,13 @@ internal class CodeGeneratorVisitor(val context: Context, val lifetimes: Map<IrE
 
                 // Globals initalizers may contain accesses to objects, so visit them first.
                 appendingTo(bbInit) {
+                    // Let runtime know locations of global references, so that heap dump could start from them.
+                    context.llvm.fileInitializers
+                            .filter { it.type.binaryTypeIsReference() }
+                            .forEach {
+                                val address = context.llvmDeclarations.forStaticField(it).storage
+                                call(context.llvm.registerGlobalRootFunction, listOf(address))
+                            }
                     context.llvm.fileInitializers
                             .forEach {
                                 if (it.initializer?.expression !is IrConst<*>?) {
@@ -2061,12 +2068,12 @@ internal class CodeGeneratorVisitor(val context: Context, val lifetimes: Map<IrE
             val thisValue = if (constructedClass.isArray) {
                 assert(args.isNotEmpty() && args[0].type == int32Type)
                 functionGenerationContext.allocArray(codegen.typeInfoValue(constructedClass), args[0],
-                        resultLifetime(callee))
+                        resultLifetime(callee), currentCodeContext.exceptionHandler)
             } else if (constructedClass == context.ir.symbols.string.owner) {
                 // TODO: consider returning the empty string literal instead.
                 assert(args.isEmpty())
                 functionGenerationContext.allocArray(codegen.typeInfoValue(constructedClass), count = kImmZero,
-                        lifetime = resultLifetime(callee))
+                        lifetime = resultLifetime(callee), exceptionHandler = currentCodeContext.exceptionHandler)
             } else if (constructedClass.isObjCClass()) {
                 assert(constructedClass.isKotlinObjCClass()) // Calls to other ObjC class constructors must be lowered.
                 val symbols = context.ir.symbols
@@ -2081,7 +2088,8 @@ internal class CodeGeneratorVisitor(val context: Context, val lifetimes: Map<IrE
                     callDirect(symbols.interopObjCRelease.owner, listOf(rawPtr), Lifetime.IRRELEVANT)
                 }
             } else {
-                functionGenerationContext.allocInstance(constructedClass, resultLifetime(callee))
+                functionGenerationContext.allocInstance(constructedClass, resultLifetime(callee),
+                        currentCodeContext.exceptionHandler)
             }
             evaluateSimpleFunctionCall(callee.symbol.owner,
                     listOf(thisValue) + args, Lifetime.IRRELEVANT /* constructor doesn't return anything */)
@@ -2203,7 +2211,8 @@ internal class CodeGeneratorVisitor(val context: Context, val lifetimes: Map<IrE
                 val typeParameterT = context.ir.symbols.createUninitializedInstance.descriptor.typeParameters[0]
                 val enumClass = callee.getTypeArgument(typeParameterT)!!
                 val enumIrClass = enumClass.getClass()!!
-                functionGenerationContext.allocInstance(enumIrClass, resultLifetime(callee))
+                functionGenerationContext.allocInstance(enumIrClass, resultLifetime(callee),
+                        currentCodeContext.exceptionHandler)
             }
 
             context.ir.symbols.listOfInternal.descriptor -> {
@@ -18,6 +18,7 @@ package org.jetbrains.kotlin.backend.konan.llvm
 
 import llvm.*
 import org.jetbrains.kotlin.backend.konan.Context
+import org.jetbrains.kotlin.backend.konan.binaryTypeIsReference
 import org.jetbrains.kotlin.backend.konan.descriptors.*
 import org.jetbrains.kotlin.backend.konan.irasdescriptors.*
 import org.jetbrains.kotlin.ir.declarations.IrField
@@ -31,9 +32,31 @@ internal class RTTIGenerator(override val context: Context) : ContextUtils {
         var result = 0
         if (classDescriptor.isFrozen)
            result = result or 1 /* TF_IMMUTABLE */
+        if (isAcyclic(classDescriptor))
+           result = result or 2 /* TF_ACYCLIC */
         return result
     }
 
+    private val acyclicClasses = mutableMapOf<ClassDescriptor, Boolean>()
+
+    /**
+     * Instances of acyclic class cannot be a part of reference cycle, as its fields may only refer to
+     * instances of final acyclic classes.
+     */
+    private fun isAcyclic(classDescriptor: ClassDescriptor): Boolean = acyclicClasses.getOrPut(classDescriptor) {
+        // Class referring to itself, directly or not, is found cyclic, as it is being checked.
+        acyclicClasses[classDescriptor] = false
+        when {
+            classDescriptor.fqNameSafe.asString() == "kotlin.Array" -> false
+            classDescriptor.isObjCClass() -> false
+            else -> getFields(classDescriptor).all {
+                if (!it.type.binaryTypeIsReference()) return@all true
+                val fieldClass = it.type.getClass()
+                fieldClass != null && fieldClass.isFinalClass && isAcyclic(fieldClass)
+            }
+        }
+    }
+
     private inner class FieldTableRecord(val nameSignature: LocalHash, val fieldOffset: Int) :
             Struct(runtime.fieldTableRecordType, nameSignature, Int32(fieldOffset))
 
@@ -33,9 +33,12 @@ internal class VariableManager(val functionGenerationContext: FunctionGeneration
         fun address() : LLVMValueRef
     }
 
-    inner class SlotRecord(val address: LLVMValueRef, val refSlot: Boolean, val isVar: Boolean) : Record {
+    inner class SlotRecord(val address: LLVMValueRef, val refSlot: Boolean, val isVar: Boolean,
+                           val deferred: Boolean = false) : Record {
         override fun load() : LLVMValueRef = functionGenerationContext.loadSlot(address, isVar)
-        override fun store(value: LLVMValueRef) = functionGenerationContext.storeAny(value, address)
+        override fun store(value: LLVMValueRef) =
+                if (deferred) functionGenerationContext.storeStackRef(value, address)
+                else functionGenerationContext.storeAny(value, address)
         override fun address() : LLVMValueRef = this.address
         override fun toString() = (if (refSlot) "refslot" else "slot") + " for ${address}"
     }
@@ -81,10 +84,11 @@ internal class VariableManager(val functionGenerationContext: FunctionGeneration
         assert(!contextVariablesToIndex.contains(descriptor))
         val index = variables.size
         val type = functionGenerationContext.getLLVMType(descriptor.type)
-        val slot = functionGenerationContext.alloca(type, descriptor.name.asString(), variableLocation)
+        // References from local variables are not counted, see EnterDeferredFrame() in runtime.
+        val slot = functionGenerationContext.alloca(type, descriptor.name.asString(), variableLocation, deferred = true)
         if (value != null)
-            functionGenerationContext.storeAny(value, slot)
-        variables.add(SlotRecord(slot, functionGenerationContext.isObjectType(type), isVar))
+            functionGenerationContext.storeStackRef(value, slot)
+        variables.add(SlotRecord(slot, functionGenerationContext.isObjectType(type), isVar, deferred = true))
         contextVariablesToIndex[descriptor] = index
         return index
     }
@@ -0,0 +1,64 @@
+package runtime.memory.acyclic0
+
+import kotlin.test.*
+import konan.internal.GC
+import konan.ref.*
+
+// Only refers to final classes without reference fields, so cannot be a part of a cycle.
+class Leaf(val name: String, val data: IntArray, val bytes: ByteArray)
+
+// Refers to itself.
+class Node(var next: Node?)
+
+// Refers to itself through another class.
+class Outer(var inner: Inner?)
+class Inner(var outer: Outer?)
+
+// Refers to a non-final class, whose subclass may refer back.
+open class Base
+class Holder(var value: Base?)
+class Derived(var holder: Holder?) : Base()
+
+var sink: Any? = null
+
+@Test fun runTest() {
+    GC.collect()
+    for (i in 0 until 1000) {
+        sink = Leaf("leaf", IntArray(4), ByteArray(8))
+    }
+    sink = null
+    GC.collect()
+    assertEquals(0, GC.collectionEvents().last().toFreeSize)
+    // Freed by reference counting alone.
+    assertNull(createLeaf().get())
+
+    val node = createNodeLoop()
+    val outer = createOuterLoop()
+    val holder = createHolderLoop()
+    GC.collect()
+    assertTrue(GC.collectionEvents().last().toFreeSize > 0)
+    assertNull(node.get())
+    assertNull(outer.get())
+    assertNull(holder.get())
+    println("OK")
+}
+
+private fun createLeaf(): WeakReference<Any> = WeakReference(Leaf("leaf", IntArray(4), ByteArray(8)))
+
+private fun createNodeLoop(): WeakReference<Any> {
+    val node = Node(null)
+    node.next = Node(node)
+    return WeakReference(node)
+}
+
+private fun createOuterLoop(): WeakReference<Any> {
+    val outer = Outer(null)
+    outer.inner = Inner(outer)
+    return WeakReference(outer)
+}
+
+private fun createHolderLoop(): WeakReference<Any> {
+    val holder = Holder(null)
+    holder.value = Derived(holder)
+    return WeakReference(holder)
+}
@@ -0,0 +1,46 @@
+import kotlinx.cinterop.*
+import konan.internal.GC
+import platform.posix.*
+
+class Data(val x: Int)
+
+// Keeps allocated objects on the heap.
+var last: Data? = null
+
+fun readFile(path: String): ByteArray {
+    val file = fopen(path, "rb") ?: throw Error("Cannot open $path")
+    try {
+        fseek(file, 0, SEEK_END)
+        val size = ftell(file).toInt()
+        fseek(file, 0, SEEK_SET)
+        val bytes = ByteArray(size)
+        if (size > 0 && fread(bytes.refTo(0), 1.signExtend<size_t>(), size.signExtend<size_t>(), file).toInt() != size)
+            throw Error("Cannot read $path")
+        return bytes
+    } finally {
+        fclose(file)
+    }
+}
+
+fun main(args: Array<String>) {
+    GC.startAllocationProfiling(16)
+    var sum = 0
+    for (i in 0 until 100_000) {
+        last = Data(i)
+        sum += last!!.x and 1
+    }
+    GC.stopAllocationProfiling()
+
+    val path = "alloc_profile0.pb"
+    if (!GC.writeAllocationProfile(path)) throw Error("Cannot write profile")
+    val bytes = readFile(path)
+    remove(path)
+
+    // Profile starts with string table entry (field 6, length-delimited).
+    if (bytes.isEmpty() || bytes[0].toInt() != 0x32) throw Error("Not a profile")
+    val text = bytes.stringFromUtf8()
+    if (!text.contains("alloc_space") || !text.contains("Data")) throw Error("No samples")
+    // Almost every allocation is sampled, but samples with identical stacks are aggregated.
+    if (bytes.size > 64 * 1024) throw Error("Samples are not aggregated: ${bytes.size} bytes")
+    println("OK $sum")
+}
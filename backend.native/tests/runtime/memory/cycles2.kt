@@ -0,0 +1,25 @@
+package runtime.memory.cycles2
+
+import kotlin.test.*
+import konan.internal.GC
+
+class Node(var next: Node?)
+
+fun makeRing(size: Int): Node {
+    val head = Node(null)
+    var current = head
+    for (i in 1 until size) {
+        val next = Node(null)
+        current.next = next
+        current = next
+    }
+    current.next = head
+    return head
+}
+
+@Test fun runTest() {
+    // Rings that long used to overflow the native stack in the cycle collector.
+    makeRing(1000000)
+    GC.collect()
+    println("OK")
+}
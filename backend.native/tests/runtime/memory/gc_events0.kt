@@ -0,0 +1,21 @@
+package runtime.memory.gc_events0
+
+import kotlin.test.*
+import konan.internal.GC
+
+class Node(var next: Node?)
+
+@Test fun runTest() {
+    for (i in 0 until 1000) {
+        val a = Node(null)
+        a.next = Node(a)
+    }
+    GC.collect()
+    val events = GC.collectionEvents()
+    assertTrue(events.isNotEmpty())
+    val last = events.last()
+    assertTrue(last.durationMicros >= 0)
+    assertTrue(events.sumBy { it.freedContainers } > 0)
+    assertTrue(GC.collectionTrace().startsWith("{\"traceEvents\":[{\"name\":\"GC\""))
+    println("OK")
+}
@@ -0,0 +1,62 @@
+package runtime.memory.gc_incremental0
+
+import kotlin.test.*
+import konan.internal.GC
+
+class Node(val id: Int) {
+    var next: Node? = null
+    var other: Node? = null
+}
+
+fun ring(id: Int): Node {
+    val a = Node(id)
+    val b = Node(id)
+    a.next = b
+    b.next = a
+    return a
+}
+
+fun fill(live: MutableList<Node>, count: Int, headOnly: Boolean) {
+    for (i in 0 until count) {
+        val node = ring(live.size * 10)
+        if (i % 10 == 0) {
+            live.lastOrNull()?.let { node.other = it }
+            live.add(node)
+        } else if (live.isNotEmpty()) {
+            // Garbage ring, marking it traverses live rings.
+            node.next!!.other = if (headOnly) live.last() else live[i % live.size]
+        }
+    }
+}
+
+@Test fun runTest() {
+    val threshold = GC.threshold
+    GC.pauseBudgetMicros = 1
+    GC.threshold = 300
+    val live = mutableListOf<Node>()
+    fill(live, 50000, false)
+    live.forEachIndexed { index, node ->
+        assertEquals(index * 10, node.next!!.next!!.id)
+    }
+
+    // Every garbage ring refers to the whole live chain, so whole slice of candidates cannot be
+    // marked within the budget, yet incremental pauses stay close to it.
+    val budget = 1000
+    GC.pauseBudgetMicros = budget
+    GC.threshold = 300
+    fill(live, 50000, true)
+    GC.pauseBudgetMicros = 0
+    GC.threshold = threshold
+    val events = GC.collectionEvents()
+    assertTrue(events.any { it.incremental })
+    events.filter { it.incremental }.forEach {
+        assertTrue(it.durationMicros < 10 * budget, "Incremental pause of ${it.durationMicros} us")
+    }
+
+    GC.collect()
+    assertFalse(GC.collectionEvents().last().incremental)
+    live.forEachIndexed { index, node ->
+        assertEquals(index * 10, node.next!!.next!!.id)
+    }
+    println("OK")
+}
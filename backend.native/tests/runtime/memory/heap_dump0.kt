@@ -0,0 +1,116 @@
+import kotlinx.cinterop.*
+import konan.internal.GC
+import platform.posix.*
+
+class Node(val id: Int, val next: Node?)
+
+fun chain(length: Int): Node? {
+    var result: Node? = null
+    for (i in 0 until length) result = Node(i, result)
+    return result
+}
+
+// Reachable from global variable.
+val globalChain = chain(10)
+
+// Reachable from object.
+object Registry {
+    val nodes = chain(3)
+}
+
+fun readFile(path: String): ByteArray {
+    val file = fopen(path, "rb") ?: throw Error("Cannot open $path")
+    try {
+        fseek(file, 0, SEEK_END)
+        val size = ftell(file).toInt()
+        fseek(file, 0, SEEK_SET)
+        val bytes = ByteArray(size)
+        if (size > 0 && fread(bytes.refTo(0), 1.signExtend<size_t>(), size.signExtend<size_t>(), file).toInt() != size)
+            throw Error("Cannot read $path")
+        return bytes
+    } finally {
+        fclose(file)
+    }
+}
+
+class DumpReader(val bytes: ByteArray) {
+    var position = 0
+
+    val atEnd get() = position == bytes.size
+
+    fun u8() = bytes[position++].toInt() and 0xff
+
+    fun u32(): Int {
+        var result = 0
+        for (i in 0 until 4) result = result or (u8() shl (8 * i))
+        return result
+    }
+
+    fun u64(): Long {
+        var result = 0L
+        for (i in 0 until 8) result = result or (u8().toLong() shl (8 * i))
+        return result
+    }
+
+    fun string(length: Int): String {
+        val result = bytes.stringFromUtf8(position, length)
+        position += length
+        return result
+    }
+}
+
+fun main(args: Array<String>) {
+    val localChain = chain(5)
+    val registryNodes = Registry.nodes
+
+    val path = "heap_dump0.knhd"
+    if (!GC.dumpHeap(path)) throw Error("Cannot write heap dump")
+    val reader = DumpReader(readFile(path))
+    remove(path)
+
+    if (reader.string(4) != "KNHD") throw Error("Wrong header")
+    if (reader.u32() != 1) throw Error("Wrong version")
+
+    val typeNames = mutableMapOf<Long, String>()
+    val roots = mutableSetOf<Long>()
+    val objects = mutableMapOf<Long, Long>()
+    var containers = 0
+    loop@ while (true) {
+        when (reader.u8()) {
+            0 -> break@loop
+            1 -> {
+                val id = reader.u64()
+                typeNames[id] = reader.string(reader.u32())
+            }
+            2 -> {
+                reader.u64()
+                reader.u8()
+                reader.u32()
+                reader.u32()
+                containers++
+            }
+            3 -> {
+                val id = reader.u64()
+                reader.u64()
+                val type = reader.u64()
+                if (type !in typeNames) throw Error("Object precedes its type")
+                reader.u32()
+                val refs = reader.u32()
+                for (i in 0 until refs) reader.u64()
+                if (objects.put(id, type) != null) throw Error("Object is dumped twice")
+            }
+            4 -> roots.add(reader.u64())
+            else -> throw Error("Unknown record")
+        }
+    }
+    if (!reader.atEnd) throw Error("Data after end of dump")
+    if (containers == 0) throw Error("No containers")
+
+    // Nodes are reachable from global, object and local variable roots.
+    val nodes = objects.values.count { typeNames[it] == "Node" }
+    if (nodes != 10 + 3 + 5) throw Error("Wrong number of nodes: $nodes")
+    if (roots.size < 3) throw Error("Wrong number of roots: ${roots.size}")
+    if (!roots.all { it in objects }) throw Error("Root is not dumped")
+
+    println("OK ${localChain!!.id} ${registryNodes!!.id}")
+}
@@ -0,0 +1,24 @@
+package runtime.memory.heap_limit0
+
+import kotlin.test.*
+import konan.internal.GC
+
+class Node(var next: Node?)
+
+@Test fun runTest() {
+    GC.collect()
+    assertTrue(GC.heapBytes > 0)
+    GC.heapHardLimit = GC.heapBytes + 1024 * 1024
+    val kept = ByteArray(512 * 1024)
+    assertFailsWith<OutOfMemoryError> {
+        ByteArray(1024 * 1024)
+    }
+    // Cyclic garbage is collected before giving up.
+    for (i in 0 until 100000) {
+        val node = Node(null)
+        node.next = Node(node)
+    }
+    GC.heapHardLimit = 0
+    assertEquals(512 * 1024, kept.size)
+    println("OK")
+}
@@ -0,0 +1,22 @@
+package runtime.memory.stats0
+
+import kotlin.test.*
+import konan.internal.GC
+import konan.worker.*
+
+data class Data(val x: Int)
+
+@Test fun runTest() {
+    assertFalse(GC.collectStatistics)
+    GC.collectStatistics = true
+    GC.resetStatistics()
+    val list = mutableListOf<Data>()
+    for (i in 0 until 100) list.add(Data(i))
+    list.freeze()
+    val stats = GC.statistics()
+    GC.collectStatistics = false
+    assertTrue(stats.startsWith("{\"enabled\":true"))
+    assertTrue(stats.contains("runtime.memory.stats0.Data"))
+    assertTrue(stats.contains("\"freeze\":{\"calls\":1"))
+    println("OK")
+}
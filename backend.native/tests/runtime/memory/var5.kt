@@ -0,0 +1,42 @@
+package runtime.memory.var5
+
+import kotlin.test.*
+import konan.internal.GC
+import konan.worker.*
+
+class Node(var next: Node?, val value: Int)
+
+fun churn(depth: Int): Int {
+    if (depth == 0) {
+        // Lots of garbage, so that references from deferred slots are reconciled.
+        var sum = 0
+        for (i in 0 until 20000) {
+            var node = Node(null, i)
+            node = Node(node, i + 1)
+            sum += node.next!!.value
+        }
+        GC.collect()
+        return sum
+    }
+    return churn(depth - 1)
+}
+
+@Test fun runTest() {
+    // Objects referenced only from local variables must survive reconciliation and collection.
+    var ring = Node(null, 1)
+    ring.next = Node(ring, 2)
+    val local = Node(null, 42)
+    churn(10)
+    assertEquals(42, local.value)
+    assertEquals(1, ring.next!!.next!!.value)
+
+    ring = Node(null, 3)
+    GC.collect()
+    assertEquals(3, ring.value)
+
+    // Frozen objects referenced from locals stay alive once frozen.
+    val frozen = Node(Node(null, 5), 4).freeze()
+    churn(3)
+    assertEquals(5, frozen.next!!.value)
+    println("OK")
+}
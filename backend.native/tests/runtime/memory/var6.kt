@@ -0,0 +1,13 @@
+import konan.internal.GC
+
+// Local variable of main() is a deferred slot of the frame, which is never left. Arrays it held
+// before must still be freed, rather than kept until the end of main().
+fun main(args: Array<String>) {
+    val size = 50_000_000
+    for (i in 0 until 100) {
+        val a = ByteArray(size)
+        a[0] = 1
+        if (GC.heapBytes > 3L * size) throw Error("Heap is ${GC.heapBytes} bytes after $i iterations")
+    }
+    println("OK")
+}
@@ -0,0 +1,24 @@
+package runtime.memory.weak2
+
+import kotlin.test.*
+import konan.ref.*
+
+data class Data(val index: Int)
+
+@Test fun runTest() {
+    val alive = mutableListOf<Data>()
+    val refs = mutableListOf<WeakReference<Data>>()
+    for (i in 0 until 10000) {
+        val data = Data(i)
+        if (i % 2 == 0) alive.add(data)
+        refs.add(WeakReference(data))
+        // Weak references to the same object share the counter.
+        assertEquals(data, WeakReference(data).get())
+    }
+    konan.internal.GC.collect()
+    refs.forEachIndexed { index, ref ->
+        if (index % 2 == 0) assertEquals(Data(index), ref.get())
+        else assertNull(ref.get())
+    }
+    println("OK")
+}
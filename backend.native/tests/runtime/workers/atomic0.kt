@@ -78,6 +78,34 @@ fun test4() {
     }
 }
 
+fun test5(workers: Array<Worker>) {
+    // Lock-free readers race with the replacement of the value, which is released once replaced.
+    val common = AtomicReference(Data(0).freeze())
+    val done = AtomicInt(0)
+    val futures = Array(workers.size, { workerIndex ->
+        workers[workerIndex].schedule(TransferMode.CHECKED, { Pair(common, done) }) {
+            (place, stop) ->
+            var last = 0
+            var ordered = true
+            while (stop.get() == 0) {
+                val current = place.get()!!.value
+                if (current < last) ordered = false
+                last = current
+            }
+            ordered
+        }
+    })
+    for (i in 1..10000) {
+        val old = common.get()
+        assertEquals(common.compareAndSwap(old, Data(i).freeze()), old)
+    }
+    done.increment()
+    futures.forEach {
+        assertEquals(it.result(), true)
+    }
+    assertEquals(common.get()!!.value, 10000)
+}
+
 @Test fun runTest() {
     val COUNT = 20
     val workers = Array(COUNT, { _ -> startWorker()})
@@ -86,6 +114,7 @@ fun test4() {
     test2(workers)
     test3(workers)
     test4()
+    test5(workers)
 
     workers.forEach {
         it.requestTermination().consume { _ -> }
@@ -0,0 +1,29 @@
+package runtime.workers.freeze6
+
+import kotlin.test.*
+import konan.worker.*
+
+class Node(val id: Int, var next: Node?, var back: Node?)
+
+@Test fun runTest() {
+    // Long ring, where every node also points a few steps back, is a single large component.
+    val head = Node(0, null, null)
+    var current = head
+    val nodes = mutableListOf(head)
+    for (i in 1 until 100000) {
+        val node = Node(i, null, nodes[maxOf(0, i - 5)])
+        current.next = node
+        current = node
+        nodes.add(node)
+    }
+    current.next = head
+    head.freeze()
+    assertTrue(nodes.all { it.isFrozen })
+    var node = head
+    for (i in 0 until 100000) {
+        assertEquals(i, node.id)
+        node = node.next!!
+    }
+    assertEquals(head, node)
+    println("OK")
+}
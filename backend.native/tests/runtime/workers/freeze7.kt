@@ -0,0 +1,67 @@
+package runtime.workers.freeze7
+
+import kotlin.test.*
+
+import konan.ref.*
+import konan.worker.*
+
+data class Entry(val key: String, val value: Int)
+
+class Table(size: Int) {
+    val entries = Array(size) { Entry("key$it", it) }
+}
+
+@Test fun runTest() {
+    // Frozen table is referenced from all workers at once, and released on each of them.
+    val table = Table(100).freeze()
+    val workers = Array(4) { startWorker() }
+    val futures = workers.map {
+        it.schedule(TransferMode.CHECKED, { table }) { shared ->
+            var sum = 0
+            for (round in 0 until 1000) {
+                for (entry in shared.entries) {
+                    val copy = entry
+                    sum += copy.value
+                }
+            }
+            sum
+        }
+    }
+    futures.forEach {
+        assertEquals(1000 * 99 * 100 / 2, it.result())
+    }
+    workers.forEach {
+        it.requestTermination().result()
+    }
+    assertEquals("key42", table.entries[42].key)
+    releasedGraphIsFreed()
+    println("OK")
+}
+
+fun shareWith(workers: Array<Worker>): WeakReference<Table> {
+    val table = Table(100).freeze()
+    val futures = workers.map {
+        it.schedule(TransferMode.CHECKED, { table }) { shared -> shared.entries.size }
+    }
+    futures.forEach {
+        assertEquals(100, it.result())
+    }
+    return WeakReference(table)
+}
+
+fun releasedGraphIsFreed() {
+    // Workers apply withheld decrements once job is done, and this thread after enough releases,
+    // so that frozen graph is freed without collecting garbage.
+    val workers = Array(4) { startWorker() }
+    val weak = shareWith(workers)
+    val other = Table(1).freeze()
+    var rounds = 0
+    while (weak.get() != null) {
+        assertTrue(++rounds < 100000, "Released frozen graph is not freed")
+        val copy = other.entries[0]
+        assertEquals(0, copy.value)
+    }
+    workers.forEach {
+        it.requestTermination().result()
+    }
+}
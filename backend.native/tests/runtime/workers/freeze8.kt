@@ -0,0 +1,36 @@
+package runtime.workers.freeze8
+
+import kotlin.test.*
+
+import konan.worker.*
+
+data class Data(val value: String)
+
+class Holder(val data: Data) {
+    var self: Holder? = null
+}
+
+// Cycle is only freed by the final collection of the thread, which then drops the last reference
+// to the frozen object.
+fun leaveCycle(value: String) {
+    val holder = Holder(Data(value).freeze())
+    holder.self = holder
+}
+
+@Test fun runTest() {
+    val workers = Array(4) { startWorker() }
+    val futures = workers.map {
+        it.schedule(TransferMode.CHECKED, { "worker" }) { name ->
+            leaveCycle(name + 1)
+            name.length
+        }
+    }
+    futures.forEach {
+        assertEquals(6, it.result())
+    }
+    workers.forEach {
+        it.requestTermination().result()
+    }
+    leaveCycle("main" + 1)
+    println("OK")
+}
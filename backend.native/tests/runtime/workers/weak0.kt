@@ -0,0 +1,52 @@
+package runtime.workers.weak0
+
+import kotlin.test.*
+
+import konan.internal.GC
+import konan.ref.*
+import konan.worker.*
+
+data class Data(val value: Int)
+
+class Job(val weak: WeakReference<Data>, val value: Int, val started: AtomicInt, val dropped: AtomicInt)
+
+fun publish(value: Int) = WeakReference(Data(value).freeze()).freeze()
+
+fun race(workers: Array<Worker>, round: Int) {
+    val weak = publish(round)
+    val started = AtomicInt(0)
+    val dropped = AtomicInt(0)
+    val futures = workers.map {
+        it.schedule(TransferMode.CHECKED, { Job(weak, round, started, dropped) }) { job ->
+            job.started.increment()
+            var valid = true
+            for (i in 0 until 100000) {
+                val data = job.weak.get() ?: break
+                if (data.value != job.value) valid = false
+                // Apply withheld decrements, so that the referent could die while others are reading it.
+                if (job.dropped.get() != 0) GC.collect()
+            }
+            valid
+        }
+    }
+    while (started.get() < workers.size) {}
+    // Release the referent of this thread, while workers are reading it.
+    dropped.increment()
+    GC.collect()
+    futures.forEach {
+        assertEquals(it.result(), true)
+    }
+    GC.collect()
+    assertNull(weak.get())
+}
+
+@Test fun runTest() {
+    val workers = Array(4) { startWorker() }
+    for (round in 0 until 10) {
+        race(workers, round)
+    }
+    workers.forEach {
+        it.requestTermination().result()
+    }
+    println("OK")
+}
@@ -0,0 +1,52 @@
+package runtime.workers.worker10
+
+import kotlin.test.*
+
+import konan.worker.*
+
+data class Chunk(val index: Int, val payload: IntArray, val next: Chunk?)
+
+// Builds a frozen list, allocated on the worker thread.
+fun build(seed: Int, length: Int): Chunk {
+    var result: Chunk? = null
+    for (i in 0 until length) {
+        result = Chunk(i, IntArray(i % 64) { seed + it }, result)
+    }
+    return result!!.freeze()
+}
+
+fun sum(chunk: Chunk?): Long {
+    var current = chunk
+    var result = 0L
+    while (current != null) {
+        result += current.payload.sum()
+        current = current.next
+    }
+    return result
+}
+
+@Test fun runTest() {
+    // Workers allocate in parallel, and their frozen results are released by other workers and by main thread.
+    val workers = Array(4) { startWorker() }
+    var previous: Array<Chunk>? = null
+    for (round in 0 until 20) {
+        val inputs = previous
+        val futures = workers.mapIndexed { index, worker ->
+            worker.schedule(TransferMode.CHECKED, { Pair(index, inputs?.get((index + 1) % inputs.size)) }) { input ->
+                val consumed = sum(input.second)
+                Pair(build(input.first, 2000), consumed)
+            }
+        }
+        val results = futures.map { it.result() }
+        if (inputs != null) {
+            results.forEachIndexed { index, result ->
+                assertEquals(sum(inputs[(index + 1) % inputs.size]), result.second)
+            }
+        }
+        previous = Array(results.size) { results[it].first }
+    }
+    workers.forEach {
+        it.requestTermination().result()
+    }
+    println("OK")
+}
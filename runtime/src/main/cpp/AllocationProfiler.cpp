@@ -0,0 +1,395 @@
+/*
+ * Copyright 2010-2018 JetBrains s.r.o.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <math.h>
+#include <string.h>
+
+#include "Alloc.h"
+#include "AllocationProfiler.h"
+#include "Atomic.h"
+#include "Exceptions.h"
+#include "ExecFormat.h"
+#include "KString.h"
+#include "MemoryPrivate.hpp"
+#include "Porting.h"
+#include "Types.h"
+#include "Utils.h"
+
+int64_t allocationSamplingInterval = 0;
+int32_t allocationProfilingGeneration = 0;
+THREAD_LOCAL_VARIABLE int64_t bytesUntilNextSample = 0;
+THREAD_LOCAL_VARIABLE int32_t sampledGeneration = 0;
+
+namespace {
+
+// Deepest stack recorded for a sample.
+constexpr int kMaxSampleDepth = 64;
+// Maximal number of distinct samples kept by the profiler, so that long profiling sessions
+// use bounded memory (up to 4MB of frames on 64-bit targets).
+constexpr uint32_t kMaxSamples = 8 * 1024;
+constexpr uint32_t kNoSample = static_cast<uint32_t>(-1);
+
+// Samples with the same type, size, interval and stack are aggregated into one.
+struct AllocationSample {
+  const TypeInfo* typeInfo;
+  uint64_t size;
+  // Sampling interval at the moment of sampling, used to scale the sample.
+  int64_t interval;
+  // Number of aggregated samples.
+  uint64_t count;
+  // Range of sample's frames in AllocationProfile::frames.
+  uint32_t firstFrame;
+  uint32_t depth;
+  // Next sample with the same hash.
+  uint32_t next;
+};
+
+struct AllocationProfile {
+  SimpleMutex lock;
+  KStdVector<AllocationSample> samples;
+  KStdVector<void*> frames;
+  // First sample for each hash of sample's type, size, interval and stack.
+  KStdUnorderedMap<uint64_t, uint32_t> index;
+  // Samples, which were neither aggregated nor recorded, as the profile is full.
+  uint64_t dropped;
+
+  void clear() {
+    samples.clear();
+    frames.clear();
+    index.clear();
+    dropped = 0;
+  }
+
+  void add(const TypeInfo* typeInfo, uint64_t size, int64_t interval, void* const* stack, uint32_t depth) {
+    uint64_t hash = sampleHash(typeInfo, size, interval, stack, depth);
+    auto it = index.find(hash);
+    uint32_t first = it != index.end() ? it->second : kNoSample;
+    for (uint32_t current = first; current != kNoSample; current = samples[current].next) {
+      auto& sample = samples[current];
+      if (sample.typeInfo == typeInfo && sample.size == size && sample.interval == interval &&
+          sample.depth == depth && memcmp(frames.data() + sample.firstFrame, stack, depth * sizeof(void*)) == 0) {
+        sample.count++;
+        return;
+      }
+    }
+    if (samples.size() >= kMaxSamples) {
+      dropped++;
+      return;
+    }
+    AllocationSample sample = { typeInfo, size, interval, 1, static_cast<uint32_t>(frames.size()), depth, first };
+    index[hash] = samples.size();
+    samples.push_back(sample);
+    frames.insert(frames.end(), stack, stack + depth);
+  }
+
+ private:
+  static uint64_t sampleHash(const TypeInfo* typeInfo, uint64_t size, int64_t interval,
+                             void* const* stack, uint32_t depth) {
+    // FNV-1a over words.
+    uint64_t hash = 14695981039346656037ULL;
+    auto mix = [&hash](uint64_t value) {
+      hash ^= value;
+      hash *= 1099511628211ULL;
+    };
+    mix(reinterpret_cast<uintptr_t>(typeInfo));
+    mix(size);
+    mix(static_cast<uint64_t>(interval));
+    for (uint32_t index = 0; index < depth; index++)
+      mix(reinterpret_cast<uintptr_t>(stack[index]));
+    return hash;
+  }
+};
+
+AllocationProfile* profile = nullptr;
+
+THREAD_LOCAL_VARIABLE uint64_t randomState = 0;
+
+// Returns random value uniformly distributed in (0, 1].
+double nextRandom() {
+  if (randomState == 0) {
+    randomState = konan::getTimeNanos() ^ reinterpret_cast<uintptr_t>(&randomState);
+    if (randomState == 0) randomState = 1;
+  }
+  // xorshift64*.
+  randomState ^= randomState >> 12;
+  randomState ^= randomState << 25;
+  randomState ^= randomState >> 27;
+  uint64_t value = randomState * 2685821657736338717ULL;
+  return ((value >> 11) + 1) * (1.0 / (1ULL << 53));
+}
+
+// Distance to the next sample is exponentially distributed, so that sampled allocations
+// form a Poisson process over allocated bytes.
+int64_t nextSampleDistance(int64_t interval) {
+  return static_cast<int64_t>(-log(nextRandom()) * interval) + 1;
+}
+
+// Minimal protobuf encoder, enough to write profile.proto messages.
+class ProtoWriter {
+ public:
+  void varint(uint64_t value) {
+    while (value >= 0x80) {
+      buffer_.push_back(static_cast<char>(value | 0x80));
+      value >>= 7;
+    }
+    buffer_.push_back(static_cast<char>(value));
+  }
+
+  void int64Field(int field, int64_t value) {
+    varint(static_cast<uint64_t>(field) << 3);
+    varint(static_cast<uint64_t>(value));
+  }
+
+  void bytesField(int field, const void* data, size_t size) {
+    varint((static_cast<uint64_t>(field) << 3) | 2);
+    varint(size);
+    const char* bytes = reinterpret_cast<const char*>(data);
+    buffer_.insert(buffer_.end(), bytes, bytes + size);
+  }
+
+  void messageField(int field, const ProtoWriter& message) {
+    bytesField(field, message.buffer_.data(), message.buffer_.size());
+  }
+
+  const KStdVector<char>& buffer() const { return buffer_; }
+
+ private:
+  KStdVector<char> buffer_;
+};
+
+// Field numbers of profile.proto, see https://github.com/google/pprof/blob/master/proto/profile.proto.
+enum {
+  kProfileSampleType = 1,
+  kProfileSample = 2,
+  kProfileLocation = 4,
+  kProfileFunction = 5,
+  kProfileStringTable = 6,
+  kProfilePeriodType = 11,
+  kProfilePeriod = 12,
+  kProfileComment = 13,
+  kValueTypeType = 1,
+  kValueTypeUnit = 2,
+  kSampleLocationId = 1,
+  kSampleValue = 2,
+  kSampleLabel = 3,
+  kLabelKey = 1,
+  kLabelStr = 2,
+  kLocationId = 1,
+  kLocationAddress = 3,
+  kLocationLine = 4,
+  kLineFunctionId = 1,
+  kFunctionId = 1,
+  kFunctionName = 2,
+  kFunctionSystemName = 3
+};
+
+// FNV-1a, as std::hash is not defined for strings with custom allocator.
+struct StringHash {
+  size_t operator()(const KStdString& value) const {
+    uint64_t hash = 14695981039346656037ULL;
+    for (char c : value) {
+      hash ^= static_cast<uint8_t>(c);
+      hash *= 1099511628211ULL;
+    }
+    return hash;
+  }
+};
+
+template <class Value>
+using StringMap = std::unordered_map<KStdString, Value, StringHash, std::equal_to<KStdString>,
+                                     KonanAllocator<std::pair<const KStdString, Value>>>;
+
+class ProfileBuilder {
+ public:
+  ProfileBuilder() {
+    // String table must start with an empty string.
+    string("");
+  }
+
+  int64_t string(const KStdString& value) {
+    auto it = strings_.find(value);
+    if (it != strings_.end()) return it->second;
+    int64_t index = strings_.size();
+    strings_[value] = index;
+    profile_.bytesField(kProfileStringTable, value.data(), value.size());
+    return index;
+  }
+
+  void valueType(int field, const char* type, const char* unit) {
+    ProtoWriter message;
+    message.int64Field(kValueTypeType, string(type));
+    message.int64Field(kValueTypeUnit, string(unit));
+    profile_.messageField(field, message);
+  }
+
+  uint64_t location(void* address) {
+    auto it = locations_.find(address);
+    if (it != locations_.end()) return it->second;
+    uint64_t id = locations_.size() + 1;
+    locations_[address] = id;
+
+    char symbol[512];
+    // Frames hold return addresses, which may already belong to the next function.
+    const void* callSite = reinterpret_cast<const char*>(address) - 1;
+    if (!AddressToSymbol(callSite, symbol, sizeof(symbol))) {
+      konan::snprintf(symbol, sizeof(symbol), "%p", address);
+    }
+    ProtoWriter line;
+    line.int64Field(kLineFunctionId, function(symbol));
+    ProtoWriter message;
+    message.int64Field(kLocationId, id);
+    message.int64Field(kLocationAddress, reinterpret_cast<uintptr_t>(address));
+    message.messageField(kLocationLine, line);
+    profile_.messageField(kProfileLocation, message);
+    return id;
+  }
+
+  uint64_t function(const KStdString& name) {
+    auto it = functions_.find(name);
+    if (it != functions_.end()) return it->second;
+    uint64_t id = functions_.size() + 1;
+    functions_[name] = id;
+    ProtoWriter message;
+    message.int64Field(kFunctionId, id);
+    message.int64Field(kFunctionName, string(name));
+    message.int64Field(kFunctionSystemName, string(name));
+    profile_.messageField(kProfileFunction, message);
+    return id;
+  }
+
+  void sample(const AllocationSample& sample, void* const* frames) {
+    ProtoWriter message;
+    ProtoWriter locations;
+    for (uint32_t index = 0; index < sample.depth; index++) {
+      locations.varint(location(frames[index]));
+    }
+    message.messageField(kSampleLocationId, locations);
+    // Sample represents all allocations of the same size, which could be sampled instead of aggregated ones.
+    double scale = sample.count / (1.0 - exp(-static_cast<double>(sample.size) / sample.interval));
+    ProtoWriter values;
+    values.varint(static_cast<int64_t>(scale + 0.5));
+    values.varint(static_cast<int64_t>(scale * sample.size + 0.5));
+    message.messageField(kSampleValue, values);
+    ProtoWriter label;
+    label.int64Field(kLabelKey, string("type"));
+    KStdString typeName;
+    AppendTypeName(typeName, sample.typeInfo);
+    label.int64Field(kLabelStr, string(typeName));
+    message.messageField(kSampleLabel, label);
+    profile_.messageField(kProfileSample, message);
+  }
+
+  void period(int64_t value) {
+    valueType(kProfilePeriodType, "space", "bytes");
+    profile_.int64Field(kProfilePeriod, value);
+  }
+
+  void comment(const KStdString& value) {
+    profile_.int64Field(kProfileComment, string(value));
+  }
+
+  const KStdVector<char>& buffer() const { return profile_.buffer(); }
+
+ private:
+  ProtoWriter profile_;
+  StringMap<int64_t> strings_;
+  KStdUnorderedMap<void*, uint64_t> locations_;
+  StringMap<uint64_t> functions_;
+};
+
+AllocationProfile* ensureProfile() {
+  if (profile == nullptr) {
+    auto newProfile = konanConstructInstance<AllocationProfile>();
+    if (compareAndSwap(&profile, static_cast<AllocationProfile*>(nullptr), newProfile) != nullptr)
+      konanDestructInstance(newProfile);
+  }
+  return profile;
+}
+
+bool writeAllocationProfile(const char* path) {
+  auto current = ensureProfile();
+  ProfileBuilder builder;
+  builder.valueType(kProfileSampleType, "alloc_objects", "count");
+  builder.valueType(kProfileSampleType, "alloc_space", "bytes");
+  {
+    LockGuard<SimpleMutex> guard(current->lock);
+    int64_t interval = 0;
+    for (auto& sample : current->samples) {
+      builder.sample(sample, current->frames.data() + sample.firstFrame);
+      interval = sample.interval;
+    }
+    builder.period(interval);
+    if (current->dropped > 0) {
+      char message[64];
+      konan::snprintf(message, sizeof(message), "%llu samples dropped",
+                      static_cast<unsigned long long>(current->dropped));
+      builder.comment(message);
+    }
+  }
+  int file = konan::openFileForWriting(path);
+  if (file < 0) return false;
+  bool result = konan::writeFile(file, builder.buffer().data(), builder.buffer().size());
+  konan::closeFile(file);
+  return result;
+}
+
+}  // namespace
+
+void ResetAllocationSampling() {
+  sampledGeneration = __atomic_load_n(&allocationProfilingGeneration, __ATOMIC_RELAXED);
+  int64_t interval = __atomic_load_n(&allocationSamplingInterval, __ATOMIC_RELAXED);
+  if (interval != 0) bytesUntilNextSample = nextSampleDistance(interval);
+}
+
+void RecordAllocationSample(const TypeInfo* typeInfo, size_t size) {
+  int64_t interval = __atomic_load_n(&allocationSamplingInterval, __ATOMIC_RELAXED);
+  if (interval == 0) return;
+  bytesUntilNextSample = nextSampleDistance(interval);
+
+  void* frames[kMaxSampleDepth];
+  // Skip this function.
+  int depth = GetCurrentStackAddresses(frames, kMaxSampleDepth, 1);
+  auto current = ensureProfile();
+  LockGuard<SimpleMutex> guard(current->lock);
+  current->add(typeInfo, size, interval, frames, depth);
+}
+
+extern "C" {
+
+void Kotlin_konan_internal_GC_startAllocationProfiling(KRef, KInt samplingInterval) {
+  if (samplingInterval <= 0) ThrowIllegalArgumentException();
+  auto current = ensureProfile();
+  {
+    LockGuard<SimpleMutex> guard(current->lock);
+    current->clear();
+  }
+  // Threads draw distances to their first samples anew, as they see the new generation.
+  __atomic_fetch_add(&allocationProfilingGeneration, 1, __ATOMIC_RELAXED);
+  __atomic_store_n(&allocationSamplingInterval, samplingInterval, __ATOMIC_RELAXED);
+}
+
+void Kotlin_konan_internal_GC_stopAllocationProfiling(KRef) {
+  __atomic_store_n(&allocationSamplingInterval, 0, __ATOMIC_RELAXED);
+}
+
+KBoolean Kotlin_konan_internal_GC_writeAllocationProfile(KRef, KString path) {
+  char* cpath = CreateCStringFromString(path->obj());
+  bool result = writeAllocationProfile(cpath);
+  DisposeCString(cpath);
+  return result;
+}
+
+}  // extern "C"
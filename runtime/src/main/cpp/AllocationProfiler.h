@@ -0,0 +1,53 @@
+/*
+ * Copyright 2010-2018 JetBrains s.r.o.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef RUNTIME_ALLOCATIONPROFILER_H
+#define RUNTIME_ALLOCATIONPROFILER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "Common.h"
+#include "TypeInfo.h"
+
+// Mean number of bytes between sampled allocations, or 0 if profiler is stopped. Accessed with
+// relaxed atomic operations, as the profiler is started and stopped concurrently with allocations.
+extern int64_t allocationSamplingInterval;
+// Number of times profiler was started.
+extern int32_t allocationProfilingGeneration;
+// Bytes the current thread has to allocate before the next sample is taken.
+extern THREAD_LOCAL_VARIABLE int64_t bytesUntilNextSample;
+// Generation of profiling, for which bytesUntilNextSample of the current thread was drawn.
+extern THREAD_LOCAL_VARIABLE int32_t sampledGeneration;
+
+// Draws distance to the next sample of the current thread for the current profiling generation.
+void ResetAllocationSampling();
+
+// Records allocation with its stack trace.
+void RecordAllocationSample(const TypeInfo* typeInfo, size_t size);
+
+// Called on every object allocation, samples allocations at random intervals averaging
+// allocationSamplingInterval bytes, so that big objects are sampled more likely.
+ALWAYS_INLINE inline void ProfileAllocation(const TypeInfo* typeInfo, size_t size) {
+  if (__atomic_load_n(&allocationSamplingInterval, __ATOMIC_RELAXED) == 0) return;
+  // Distance left from the previous profiling, or never drawn, would bias the first sample.
+  if (__atomic_load_n(&allocationProfilingGeneration, __ATOMIC_RELAXED) != sampledGeneration)
+    ResetAllocationSampling();
+  bytesUntilNextSample -= size;
+  if (bytesUntilNextSample <= 0) RecordAllocationSample(typeInfo, size);
+}
+
+#endif // RUNTIME_ALLOCATIONPROFILER_H
@@ -265,13 +265,17 @@ OBJ_GETTER(Kotlin_CharArray_copyOf, KConstRef thiz, KInt newSize) {
   if (newSize < 0) {
     ThrowIllegalArgumentException();
   }
-  ArrayHeader* result = AllocArrayInstance(
+  ArrayHeader* result = AllocArrayInstanceUninitialized(
       array->type_info(), newSize, OBJ_RESULT)->array();
   KInt toCopy = array->count_ < newSize ?  array->count_ : newSize;
   memcpy(
       PrimitiveArrayAddressOfElementAt<KChar>(result, 0),
       PrimitiveArrayAddressOfElementAt<KChar>(array, 0),
       toCopy * sizeof(KChar));
+  memset(
+      PrimitiveArrayAddressOfElementAt<KChar>(result, toCopy),
+      0,
+      (newSize - toCopy) * sizeof(KChar));
   RETURN_OBJ(result->obj());
 }
 
@@ -469,7 +473,7 @@ OBJ_GETTER(Kotlin_ImmutableBinaryBlob_toByteArray, KConstRef thiz, KInt start, K
    if (start < 0 || count < 0 || start > array->count_ - count)  {
         ThrowArrayIndexOutOfBoundsException();
     }
-    ArrayHeader* result = AllocArrayInstance(
+    ArrayHeader* result = AllocArrayInstanceUninitialized(
           theByteArrayTypeInfo, count, OBJ_RESULT)->array();
     memcpy(PrimitiveArrayAddressOfElementAt<KByte>(result, 0),
            PrimitiveArrayAddressOfElementAt<KByte>(array, start),
@@ -25,6 +25,7 @@ namespace {
 struct AtomicReferenceLayout {
   KRef value_;
   KInt lock_;
+  KInt readers_;
 };
 
 template <typename T> T addAndGetImpl(KRef thiz, T delta) {
@@ -87,18 +88,19 @@ void Kotlin_AtomicReference_checkIfFrozen(KRef value) {
 
 OBJ_GETTER(Kotlin_AtomicReference_compareAndSwap, KRef thiz, KRef expectedValue, KRef newValue) {
     Kotlin_AtomicReference_checkIfFrozen(newValue);
-    // See Kotlin_AtomicReference_get() for explanations, why locking is needed.
+    // See Kotlin_AtomicReference_get() for explanations, why readers are awaited.
     AtomicReferenceLayout* ref = asAtomicReference(thiz);
-    RETURN_RESULT_OF(SwapRefLocked, &ref->value_, expectedValue, newValue, &ref->lock_);
+    RETURN_RESULT_OF(SwapRefLocked, &ref->value_, expectedValue, newValue, &ref->lock_, &ref->readers_);
 }
 
 OBJ_GETTER(Kotlin_AtomicReference_get, KRef thiz) {
-    // Here we must take a lock to prevent race when value, while taken here, is CASed and immediately
-    // destroyed by an another thread. AtomicReference no longer holds such an object, so if we got
-    // rescheduled unluckily, between the moment value is read from the field and RC is incremented,
-    // object may go away.
+    // Here we must prevent race when value, while taken here, is CASed and immediately destroyed by
+    // an another thread. AtomicReference no longer holds such an object, so if we got rescheduled
+    // unluckily, between the moment value is read from the field and RC is incremented, object may go away.
+    // So instead of taking the lock, reader registers itself, and compareAndSwap() does not hand out
+    // replaced value until registered readers are done.
     AtomicReferenceLayout* ref = asAtomicReference(thiz);
-    RETURN_RESULT_OF(ReadRefLocked, &ref->value_, &ref->lock_);
+    RETURN_RESULT_OF(ReadRefLockFree, &ref->value_, &ref->readers_);
 }
 
 }  // extern "C"
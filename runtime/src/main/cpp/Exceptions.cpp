@@ -113,6 +113,31 @@ _Unwind_Reason_Code unwindCallback(
   backtrace->setNextElement(line);
   return _URC_NO_REASON;
 }
+
+struct StackAddresses {
+  void** buffer;
+  int maxDepth;
+  int depth;
+  int skipCount;
+};
+
+_Unwind_Reason_Code addressesCallback(
+    struct _Unwind_Context* context, void* arg) {
+  StackAddresses* addresses = reinterpret_cast<StackAddresses*>(arg);
+  if (addresses->skipCount > 0) {
+    addresses->skipCount--;
+    return _URC_NO_REASON;
+  }
+  if (addresses->depth >= addresses->maxDepth) return _URC_END_OF_STACK;
+
+#if (__MINGW32__ || __MINGW64__)
+  _Unwind_Ptr address = _Unwind_GetRegionStart(context);
+#else
+  _Unwind_Ptr address = _Unwind_GetIP(context);
+#endif
+  addresses->buffer[addresses->depth++] = (void*)(intptr_t)address;
+  return _URC_NO_REASON;
+}
 #endif
 
 }  // namespace
@@ -161,6 +186,29 @@ OBJ_GETTER0(GetCurrentStackTrace) {
 #endif  // !OMIT_BACKTRACE
 }
 
+int GetCurrentStackAddresses(void** buffer, int maxDepth, int skipFrames) {
+#if OMIT_BACKTRACE
+  return 0;
+#else
+  // Skip this function as well.
+  skipFrames++;
+#if USE_GCC_UNWIND
+  StackAddresses addresses = { buffer, maxDepth, 0, skipFrames };
+  _Unwind_Backtrace(addressesCallback, &addresses);
+  return addresses.depth;
+#else
+  constexpr int kMaxFrames = 128;
+  void* frames[kMaxFrames];
+  int size = backtrace(frames, kMaxFrames);
+  int depth = 0;
+  for (int index = skipFrames; index < size && depth < maxDepth; ++index) {
+    buffer[depth++] = frames[index];
+  }
+  return depth;
+#endif
+#endif  // !OMIT_BACKTRACE
+}
+
 void ThrowException(KRef exception) {
   RuntimeAssert(exception != nullptr && IsInstance(exception, theThrowableTypeInfo),
                 "Throwing something non-throwable");
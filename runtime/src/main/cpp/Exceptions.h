@@ -26,6 +26,10 @@ extern "C" {
 // Returns current stacktrace as Array<String>.
 OBJ_GETTER0(GetCurrentStackTrace);
 
+// Fills `buffer` with at most `maxDepth` addresses of the current stack frames, skipping
+// `skipFrames` innermost ones. Returns number of stored addresses.
+int GetCurrentStackAddresses(void** buffer, int maxDepth, int skipFrames);
+
 // Throws arbitrary exception.
 void ThrowException(KRef exception);
 
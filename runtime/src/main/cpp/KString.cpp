@@ -41,9 +41,10 @@ KStdStringInserter utf16toUtf8OrThrow(const KChar* start, const KChar* end, KStd
 
 template<utf8to16 conversion>
 OBJ_GETTER(utf8ToUtf16Impl, const char* rawString, const char* end, uint32_t charCount) {
-  ArrayHeader* result = AllocArrayInstance(theStringTypeInfo, charCount, OBJ_RESULT)->array();
+  ArrayHeader* result = AllocArrayInstanceUninitialized(theStringTypeInfo, charCount, OBJ_RESULT)->array();
   KChar* rawResult = CharArrayAddressOfElementAt(result, 0);
   auto convertResult = conversion(rawString, end, rawResult);
+  RuntimeAssert(convertResult == rawResult + charCount, "Conversion must fill the whole string");
   RETURN_OBJ(result->obj());
 }
 
@@ -56,7 +57,7 @@ OBJ_GETTER(utf16ToUtf8Impl, KString thiz, KInt start, KInt size) {
   const KChar* utf16 = CharArrayAddressOfElementAt(thiz, start);
   KStdString utf8;
   conversion(utf16, utf16 + size, back_inserter(utf8));
-  ArrayHeader* result = AllocArrayInstance(theByteArrayTypeInfo, utf8.size(), OBJ_RESULT)->array();
+  ArrayHeader* result = AllocArrayInstanceUninitialized(theByteArrayTypeInfo, utf8.size(), OBJ_RESULT)->array();
   ::memcpy(ByteArrayAddressOfElementAt(result, 0), utf8.c_str(), utf8.size());
   RETURN_OBJ(result->obj());
 }
@@ -792,7 +793,7 @@ OBJ_GETTER(Kotlin_String_fromCharArray, KConstRef thiz, KInt start, KInt size) {
     RETURN_RESULT_OF0(TheEmptyString);
   }
 
-  ArrayHeader* result = AllocArrayInstance(
+  ArrayHeader* result = AllocArrayInstanceUninitialized(
       theStringTypeInfo, size, OBJ_RESULT)->array();
   memcpy(CharArrayAddressOfElementAt(result, 0),
          CharArrayAddressOfElementAt(array, start),
@@ -801,7 +802,7 @@ OBJ_GETTER(Kotlin_String_fromCharArray, KConstRef thiz, KInt start, KInt size) {
 }
 
 OBJ_GETTER(Kotlin_String_toCharArray, KString string) {
-  ArrayHeader* result = AllocArrayInstance(
+  ArrayHeader* result = AllocArrayInstanceUninitialized(
     theCharArrayTypeInfo, string->count_, OBJ_RESULT)->array();
   memcpy(CharArrayAddressOfElementAt(result, 0),
          CharArrayAddressOfElementAt(string, 0),
@@ -818,7 +819,7 @@ OBJ_GETTER(Kotlin_String_plusImpl, KString thiz, KString other) {
   if (result_length < thiz->count_ || result_length < other->count_) {
     ThrowArrayIndexOutOfBoundsException();
   }
-  ArrayHeader* result = AllocArrayInstance(
+  ArrayHeader* result = AllocArrayInstanceUninitialized(
     theStringTypeInfo, result_length, OBJ_RESULT)->array();
   memcpy(
       CharArrayAddressOfElementAt(result, 0),
@@ -1152,7 +1153,7 @@ OBJ_GETTER(Kotlin_String_subSequence, KString thiz, KInt startIndex, KInt endInd
     RETURN_RESULT_OF0(TheEmptyString);
   }
   KInt length = endIndex - startIndex;
-  ArrayHeader* result = AllocArrayInstance(
+  ArrayHeader* result = AllocArrayInstanceUninitialized(
     theStringTypeInfo, length, OBJ_RESULT)->array();
   memcpy(CharArrayAddressOfElementAt(result, 0),
          CharArrayAddressOfElementAt(thiz, startIndex),
@@ -17,16 +17,21 @@
 #include <string.h>
 #include <stdio.h>
 
+#include <algorithm>
 #include <cstddef> // for offsetof
 
 #include "Alloc.h"
+#include "AllocationProfiler.h"
 #include "Assert.h"
 #include "Atomic.h"
 #include "Exceptions.h"
+#include "KString.h"
 #include "Memory.h"
 #include "MemoryPrivate.hpp"
 #include "Natives.h"
 #include "Porting.h"
+#include "Utils.h"
+#include "utf8.h"
 
 // If garbage collection algorithm for cyclic garbage to be used.
 // We are using the Bacon's algorithm for GC, see
@@ -34,17 +39,87 @@
 #define USE_GC 1
 // Define to 1 to print all memory operations.
 #define TRACE_MEMORY 0
-// Collect memory manager events statistics.
-#define COLLECT_STATISTIC 0
-// Auto-adjust GC thresholds.
+// Collect memory manager events statistics, once enabled at runtime.
+#define COLLECT_STATISTIC 1
+// Auto-adjust GC thresholds, following the policy selected by KONAN_GC_POLICY environment variable.
 #define GC_ERGONOMICS 1
+// Keep log of recent garbage collections.
+#define GC_EVENT_LOG 1
+// Do not count references from local variable slots of stack frames, see EnterDeferredFrame().
+// Requires USE_GC.
+#define USE_DEFERRED_RC 1
+// Buffer decrements of frozen objects reference counters, see FrozenRCBuffer.
+#if KONAN_NO_THREADS
+#define USE_FROZEN_RC_BUFFER 0
+#else
+#define USE_FROZEN_RC_BUFFER 1
+#endif
+// Recycle memory of freed containers via per-thread size-class free lists.
+#define USE_CONTAINER_CACHE 1
+// Keep arena chunks in per-thread pools.
+#define USE_ARENA_POOL 1
+// Map big arrays directly from the OS, so that their memory is returned once freed.
+#if KONAN_NO_MMAP
+#define USE_LARGE_ARRAYS 0
+#else
+#define USE_LARGE_ARRAYS 1
+#endif
+// Account bytes allocated by all memory states against process-wide heap limits, see checkHeapBudget().
+#define USE_HEAP_BUDGET 1
+// Align payloads of primitive arrays, see KONAN_ARRAY_ALIGNMENT.
+#define USE_ALIGNED_ARRAYS (KONAN_ARRAY_ALIGNMENT > 8)
 
 namespace {
 
 // Granularity of arena container chunks.
 constexpr container_size_t kContainerAlignment = 1024;
+// Size of the first chunk of every arena.
+constexpr container_size_t kArenaMinChunkSize = kContainerAlignment;
+// Arena chunks grow geometrically up to this size, bigger chunks are only allocated
+// to fit large objects.
+constexpr container_size_t kArenaMaxChunkSize = 64 * 1024;
 // Single object alignment.
 constexpr container_size_t kObjectAlignment = 8;
+// Size of separate header of single object containers.
+constexpr container_size_t kObjectContainerHeaderSize = USE_COMPACT_OBJECTS ? 0 : sizeof(ContainerHeader);
+
+#if USE_ALIGNED_ARRAYS
+constexpr container_size_t kArrayAlignment = KONAN_ARRAY_ALIGNMENT;
+static_assert((kArrayAlignment & (kArrayAlignment - 1)) == 0 && kArrayAlignment <= 64,
+              "Array alignment must be a power of two, up to 64");
+#endif  // USE_ALIGNED_ARRAYS
+
+#if USE_CONTAINER_CACHE
+// Containers are segregated into size classes with this granularity.
+constexpr size_t kContainerCacheGranularity = kObjectAlignment;
+// Bigger containers are always returned to the system allocator.
+constexpr size_t kContainerCacheMaxSize = 256;
+constexpr int kContainerCacheClasses = kContainerCacheMaxSize / kContainerCacheGranularity;
+// Upper bound for amount of memory kept in the free list of a single size class.
+constexpr size_t kContainerCacheClassBytes = 32 * 1024;
+#endif  // USE_CONTAINER_CACHE
+
+#if USE_ARENA_POOL
+// Number of pooled chunk sizes, from kArenaMinChunkSize to kArenaMaxChunkSize.
+constexpr int kArenaChunkClasses = 7;
+// Upper bound for amount of chunk memory kept in the pool.
+constexpr size_t kArenaPoolMaxBytes = 256 * 1024;
+// Pool is trimmed down to that many bytes once no arenas are alive on the thread.
+constexpr size_t kArenaPoolIdleBytes = 64 * 1024;
+#endif  // USE_ARENA_POOL
+
+#if USE_LARGE_ARRAYS
+// Array containers of that size and bigger get their own memory mapping.
+constexpr size_t kLargeArrayThreshold = 256 * 1024;
+// Elements of arrays that big are advised to be backed with huge pages.
+constexpr size_t kHugePageArrayThreshold = 2 * 1024 * 1024;
+#endif  // USE_LARGE_ARRAYS
+
+#if USE_HEAP_BUDGET
+// Once heap is over the soft limit, state allocated at least that many bytes since its last
+// collection is collected (or even more, see heapBudgetCollectBytes()).
+constexpr size_t kHeapBudgetMinCollectBytes = 1024 * 1024;
+#endif  // USE_HEAP_BUDGET
 
 #if TRACE_MEMORY
 #define MEMORY_LOG(...) konan::consolePrintf(__VA_ARGS__);
@@ -56,28 +131,77 @@ constexpr container_size_t kObjectAlignment = 8;
 // Collection threshold default (collect after having so many elements in the
 // release candidates set).
 constexpr size_t kGcThreshold = 4 * 1024;
+// Incremental collection processes cycle candidates in slices of that size, checking
+// pause budget between slices.
+constexpr size_t kGcSliceCandidates = 256;
+// Incremental collection also checks pause budget after marking that many containers.
+constexpr size_t kGcMarkCheckInterval = 256;
+// Incremental collection falls back to non-incremental one, once that many candidates were set aside,
+// as their subgraphs cannot be marked within pause budget.
+constexpr size_t kGcOversizedCandidates = 64;
+// Deadline of non-incremental collection.
+constexpr uint64_t kGcNoDeadline = static_cast<uint64_t>(-1);
 #if GC_ERGONOMICS
-// Ergonomic thresholds.
-// If GC to computations time ratio is above that value,
-// increase GC threshold by 1.5 times.
-constexpr double kGcToComputeRatioThreshold = 0.5;
-// Never exceed this value when increasing GC threshold.
-constexpr size_t kMaxErgonomicThreshold = 1024 * 1024;
+// Ergonomic policy. Threshold is increased by 1.5 times if GC takes more than target share
+// of time, and decreased by 1.5 times if pause is longer than the target, or if GC takes less
+// than quarter of target share of time.
+struct GcPolicy {
+  const char* name;
+  // Target pause in microseconds.
+  uint64_t targetPause;
+  // Target ratio of GC time to total time.
+  double targetGcShare;
+  size_t minThreshold;
+  size_t maxThreshold;
+  // Whether threshold-triggered collections are incremental, with target pause as budget.
+  bool incremental;
+};
+
+constexpr GcPolicy kGcPolicies[] = {
+  // Rare collections, pause time is of little concern.
+  { "throughput", 50000, 0.05, kGcThreshold, 1024 * 1024, false },
+  // Short incremental pauses, even if spending more time in GC.
+  { "latency", 1000, 0.2, 256, 64 * 1024, true },
+  // Small candidates buffer, and cyclic garbage is reclaimed soon.
+  { "memory", 10000, 0.2, 256, 16 * 1024, false },
+};
 #endif  // GC_ERGONOMICS
+#if GC_EVENT_LOG
+// How many recent collections are kept in the log.
+constexpr int kGcEventLogSize = 128;
+#endif  // GC_EVENT_LOG
+#if USE_DEFERRED_RC
+// Zero count table grown by that many entries since last reconciliation is reconciled on frame leave.
+constexpr size_t kZeroCountTableThreshold = 8 * 1024;
+// Zero count table grown by that many bytes of containers since last reconciliation is reconciled
+// on allocation, so that big objects are not held by frames, which are never left.
+constexpr size_t kZeroCountTableMaxBytes = 4 * 1024 * 1024;
+#endif  // USE_DEFERRED_RC
 
 typedef KStdDeque<ContainerHeader*> ContainerHeaderDeque;
 #endif
 
+#if USE_FROZEN_RC_BUFFER
+// Number of entries in per-thread buffer of pending frozen containers decrements, power of two.
+constexpr int kFrozenRCBufferSize = 256;
+// Buffer is flushed after that many decrements, so that released frozen objects are freed even if
+// thread never collects garbage or leaves its outermost frame.
+constexpr int kFrozenRCBufferFlushInterval = 16 * kFrozenRCBufferSize;
+#endif
+
 }  // namespace
 
 #if TRACE_MEMORY || USE_GC
 typedef KStdUnorderedSet<ContainerHeader*> ContainerHeaderSet;
 typedef KStdVector<ContainerHeader*> ContainerHeaderList;
+typedef KStdVector<std::pair<ContainerHeader*, unsigned>> ContainerColorList;
 typedef KStdVector<KRef*> KRefPtrList;
 #endif
 
+// Frame-local arena lives right in the frame slots, so that no allocation is needed
+// for arena itself. Must be the first field, see GetParamSlotIfArena().
 struct FrameOverlay {
-  ArenaContainer* arena;
+  ArenaContainer arena;
 };
 
 // A little hack that allows to enable -O2 optimizations
@@ -90,131 +214,502 @@ FrameOverlay exportFrameOverlay;
 int allocCount = 0;
 int aliveMemoryStatesCount = 0;
 
+#if USE_HEAP_BUDGET
+// Current number of bytes in allocated containers of all memory states.
+size_t heapBytes = 0;
+// Process-wide heap limits in bytes, zero means no limit.
+size_t heapSoftLimit = 0;
+size_t heapHardLimit = 0;
+bool heapLimitsInitialized = false;
+#endif
+
 // Forward declarations.
 void FreeContainer(ContainerHeader* header);
 
-#if COLLECT_STATISTIC
-class MemoryStatistic {
-public:
-  // UpdateRef per-object type counters.
-  uint64_t updateCounters[4][4];
-  // Alloc per container type counters.
-  uint64_t containerAllocs[4][2];
-  // Free per container type counters.
-  uint64_t objectAllocs[4][2];
-  // Histogram of allocation size distribution.
-  KStdUnorderedMap<int, int>* allocationHistogram;
-  // Number of allocation cache hits.
-  int allocCacheHit;
-  // Number of allocation cache misses.
-  int allocCacheMiss;
-
-  // Map of array index to human readable name.
-  static constexpr const char* indexToName[] = { "normal", "stack ", "perm  ", "null  " };
+// Gets memory from the system allocator, clearing either all of it or only first `clearPrefix` bytes.
+inline void* allocSystemMemory(size_t size, bool clear, size_t clearPrefix) {
+  if (clear)
+    return konanAllocMemory(size);
+  void* result = konanAllocUninitializedMemory(size);
+  if (result != nullptr)
+    memset(result, 0, clearPrefix);
+  return result;
+}
 
+#if USE_CONTAINER_CACHE
+// Per-thread cache of container memory. Freed containers are kept in singly linked
+// free lists segregated by size class, and handed out again to allocations of the same
+// size class, so that most containers never go through the system allocator.
+// Cache is owned by the memory state, so no synchronization is needed.
+class ContainerCache {
+ public:
   void init() {
-    memset(containerAllocs, 0, sizeof(containerAllocs));
-    memset(objectAllocs, 0, sizeof(objectAllocs));
-    memset(updateCounters, 0, sizeof(updateCounters));
-    allocationHistogram = konanConstructInstance<KStdUnorderedMap<int, int>>();
-    allocCacheHit = 0;
-    allocCacheMiss = 0;
+    memset(freeLists_, 0, sizeof(freeLists_));
+    memset(freeCounts_, 0, sizeof(freeCounts_));
+    hits_ = 0;
+    misses_ = 0;
   }
 
   void deinit() {
-    konanDestructInstance(allocationHistogram);
-    allocationHistogram = nullptr;
-  }
-
-  void incUpdateRef(const ObjHeader* objOld, const ObjHeader* objNew) {
-    updateCounters[toIndex(objOld)][toIndex(objNew)]++;
+    for (int index = 0; index < kContainerCacheClasses; index++) {
+      FreeBlock* block = freeLists_[index];
+      while (block != nullptr) {
+        FreeBlock* next = block->next;
+        konanFreeMemory(block);
+        block = next;
+      }
+      freeLists_[index] = nullptr;
+      freeCounts_[index] = 0;
+    }
   }
 
-  void incAlloc(size_t size, const ContainerHeader* header) {
-    containerAllocs[toIndex(header)][0]++;
-    ++(*allocationHistogram)[size];
-#if 0
-    auto queue = memoryState->finalizerQueue;
-    bool hit = false;
-    for (int i = 0; i < queue->size(); i++) {
-      auto container = (*queue)[i];
-      if (containerSize(container) == size) {
-        hit = true;
-        break;
+  // Returns memory of at least `size` bytes. If `clear` is true memory is zeroed,
+  // otherwise only first `clearPrefix` bytes are.
+  void* alloc(size_t size, bool clear, size_t clearPrefix) {
+    int index = sizeClass(size);
+    if (index >= 0) {
+      FreeBlock* block = freeLists_[index];
+      if (block != nullptr) {
+        freeLists_[index] = block->next;
+        freeCounts_[index]--;
+        hits_++;
+        memset(block, 0, clear ? classSize(index) : clearPrefix);
+        return block;
       }
+      misses_++;
+      size = classSize(index);
     }
-    if (hit)
-      allocCacheHit++;
-    else
-      allocCacheMiss++;
-#endif  // USE_GC
+    return allocSystemMemory(size, clear, clearPrefix);
+  }
+
+  // Returns memory previously obtained with alloc() of the same `size`.
+  void free(void* memory, size_t size) {
+    int index = sizeClass(size);
+    if (index >= 0 && freeCounts_[index] < classLimit(index)) {
+      FreeBlock* block = reinterpret_cast<FreeBlock*>(memory);
+      block->next = freeLists_[index];
+      freeLists_[index] = block;
+      freeCounts_[index]++;
+      return;
+    }
+    konanFreeMemory(memory);
   }
 
-  void incFree(const ContainerHeader* header) {
-    containerAllocs[toIndex(header)][1]++;
+  // Number of allocations served from the cache.
+  uint64_t hits() const { return hits_; }
+  // Number of cacheable allocations which went to the system allocator.
+  uint64_t misses() const { return misses_; }
+
+ private:
+  struct FreeBlock {
+    FreeBlock* next;
+  };
+
+  static int sizeClass(size_t size) {
+    if (size == 0 || size > kContainerCacheMaxSize) return -1;
+    return (size + kContainerCacheGranularity - 1) / kContainerCacheGranularity - 1;
   }
 
-  void incAlloc(size_t size, const ObjHeader* header) {
-    objectAllocs[toIndex(header)][0]++;
+  static size_t classSize(int index) {
+    return (index + 1) * kContainerCacheGranularity;
   }
 
-  void incFree(const ObjHeader* header) {
-    objectAllocs[toIndex(header)][1]++;
+  static uint32_t classLimit(int index) {
+    return kContainerCacheClassBytes / classSize(index);
   }
 
-  static int toIndex(const ObjHeader* obj) {
-    if (obj == nullptr) return 3;
-    return toIndex(obj->container());
+  FreeBlock* freeLists_[kContainerCacheClasses];
+  uint32_t freeCounts_[kContainerCacheClasses];
+  uint64_t hits_;
+  uint64_t misses_;
+};
+#endif  // USE_CONTAINER_CACHE
+
+#if USE_ARENA_POOL
+// Per-thread pool of arena chunks. Pooled chunks are kept zeroed, so that
+// reused chunk could be handed to new arena as is.
+class ArenaPool {
+ public:
+  void init() {
+    memset(chunks_, 0, sizeof(chunks_));
+    activeArenas_ = 0;
+    pooledBytes_ = 0;
+  }
+
+  void deinit() {
+    trim(0);
+  }
+
+  void arenaStarted() {
+    activeArenas_++;
+  }
+
+  void arenaFinished() {
+    // Thread is idle with respect to arenas, give away big chunks.
+    if (--activeArenas_ == 0 && pooledBytes_ > kArenaPoolIdleBytes)
+      trim(kArenaPoolIdleBytes);
+  }
+
+  // Returns chunk of exactly `size` bytes, with zeroed contents after chunk header.
+  ContainerChunk* allocChunk(container_size_t size) {
+    int index = chunkClass(size);
+    if (index >= 0 && chunks_[index] != nullptr) {
+      ContainerChunk* chunk = chunks_[index];
+      chunks_[index] = chunk->next;
+      pooledBytes_ -= size;
+      return chunk;
+    }
+    ContainerChunk* chunk = konanConstructSizedInstance<ContainerChunk>(size);
+    chunk->size = size;
+    return chunk;
   }
 
-  static int toIndex(const ContainerHeader* header) {
-    switch (header->tag()) {
-      case CONTAINER_TAG_NORMAL   : return 0;
-      case CONTAINER_TAG_STACK    : return 1;
-      case CONTAINER_TAG_PERMANENT: return 2;
+  void freeChunk(ContainerChunk* chunk) {
+    int index = chunkClass(chunk->size);
+    if (index < 0 || pooledBytes_ + chunk->size > kArenaPoolMaxBytes) {
+      konanFreeMemory(chunk);
+      return;
+    }
+    // Only clear memory actually used by the arena.
+    memset(chunk->asHeader(), 0, sizeof(ContainerHeader) + chunk->used);
+    chunk->next = chunks_[index];
+    chunks_[index] = chunk;
+    pooledBytes_ += chunk->size;
+  }
+
+ private:
+  static int chunkClass(container_size_t size) {
+    int index = 0;
+    for (container_size_t classSize = kArenaMinChunkSize; classSize <= kArenaMaxChunkSize; classSize <<= 1) {
+      if (classSize == size) return index;
+      index++;
     }
-    RuntimeAssert(false, "unknown container type");
     return -1;
   }
 
-  void printStatistic() {
-    konan::consolePrintf("\nMemory manager statistic:\n\n");
-    for (int i = 0; i < 2; i++) {
-      konan::consolePrintf("Container %s alloc: %lld, free: %lld\n",
-                           indexToName[i], containerAllocs[i][0],
-                           containerAllocs[i][1]);
+  // Releases pooled chunks, biggest first, until no more than `targetBytes` are kept.
+  void trim(size_t targetBytes) {
+    for (int index = kArenaChunkClasses - 1; index >= 0 && pooledBytes_ > targetBytes; index--) {
+      while (chunks_[index] != nullptr && pooledBytes_ > targetBytes) {
+        ContainerChunk* chunk = chunks_[index];
+        chunks_[index] = chunk->next;
+        pooledBytes_ -= chunk->size;
+        konanFreeMemory(chunk);
+      }
     }
-    for (int i = 0; i < 2; i++) {
-      konan::consolePrintf("Object %s alloc: %lld, free: %lld\n",
-                           indexToName[i], objectAllocs[i][0],
-                           objectAllocs[i][1]);
+  }
+
+  ContainerChunk* chunks_[kArenaChunkClasses];
+  // Number of arenas currently used by frames of this thread.
+  int activeArenas_;
+  size_t pooledBytes_;
+};
+#endif  // USE_ARENA_POOL
+
+#if USE_FROZEN_RC_BUFFER
+// Per-thread buffer of frozen containers decrements, not yet applied to their shared counters.
+// Withheld decrements only make shared counter overestimate number of references, so container
+// with pending decrement is never freed, and subsequent increment on the same thread just cancels
+// pending decrement. Thus, repeated acquire/release of shared frozen object by some thread does not
+// touch its cache line, unless entry is evicted by a conflicting container, or buffer is flushed.
+class FrozenRCBuffer {
+ public:
+  void init() {
+    memset(entries_, 0, sizeof(entries_));
+    pending_ = 0;
+    flushing_ = false;
+  }
+
+  // Returns true if increment cancelled pending decrement of the container.
+  bool cancelDecrement(ContainerHeader* container) {
+    Entry& entry = entryOf(container);
+    if (entry.container != container) return false;
+    if (--entry.count == 0)
+      entry.container = nullptr;
+    return true;
+  }
+
+  void addDecrement(ContainerHeader* container) {
+    Entry& entry = entryOf(container);
+    if (entry.container == container) {
+      entry.count++;
+    } else {
+      // Applying evicted decrement may free containers and come here again, so update entry first.
+      Entry evicted = entry;
+      entry.container = container;
+      entry.count = 1;
+      if (evicted.container != nullptr)
+        apply(evicted);
     }
+    if (++pending_ >= kFrozenRCBufferFlushInterval && !flushing_)
+      flush();
+  }
 
-    konan::consolePrintf("\n");
-    for (int i = 0; i < 4; i++) {
-      for (int j = 0; j < 4; j++) {
-        konan::consolePrintf("UpdateRef[%s -> %s]: %lld\n",
-                             indexToName[i], indexToName[j], updateCounters[i][j]);
+  bool empty() const {
+    for (int index = 0; index < kFrozenRCBufferSize; index++) {
+      if (entries_[index].container != nullptr) return false;
+    }
+    return true;
+  }
+
+  // Applies all pending decrements, including ones caused by freeing containers.
+  void flush() {
+    if (flushing_) return;
+    flushing_ = true;
+    pending_ = 0;
+    bool applied;
+    do {
+      applied = false;
+      for (int index = 0; index < kFrozenRCBufferSize; index++) {
+        Entry pending = entries_[index];
+        if (pending.container == nullptr) continue;
+        entries_[index].container = nullptr;
+        entries_[index].count = 0;
+        apply(pending);
+        applied = true;
       }
+    } while (applied);
+    pending_ = 0;
+    flushing_ = false;
+  }
+
+ private:
+  struct Entry {
+    ContainerHeader* container;
+    uint32_t count;
+  };
+
+  Entry& entryOf(ContainerHeader* container) {
+    uintptr_t address = reinterpret_cast<uintptr_t>(container);
+    return entries_[((address >> 3) ^ (address >> 11)) & (kFrozenRCBufferSize - 1)];
+  }
+
+  static void apply(const Entry& entry) {
+    if (entry.container->decRefCount<true>(entry.count) == 0)
+      FreeContainer(entry.container);
+  }
+
+  Entry entries_[kFrozenRCBufferSize];
+  // Decrements buffered since the last flush.
+  int pending_;
+  // Whether decrements applied by flush are freeing containers, and coming here again.
+  bool flushing_;
+};
+#endif  // USE_FROZEN_RC_BUFFER
+
+namespace {
+
+// Appends Kotlin string converted to UTF-8.
+void appendUtf8(KStdString& out, KString string) {
+  const KChar* utf16 = CharArrayAddressOfElementAt(string, 0);
+  utf8::unchecked::utf16to8(utf16, utf16 + string->count_, back_inserter(out));
+}
+
+}  // namespace
+
+void AppendTypeName(KStdString& out, const TypeInfo* type) {
+  if (type->packageName_ != nullptr && type->packageName_->array()->count_ > 0) {
+    appendUtf8(out, type->packageName_->array());
+    out += ".";
+  }
+  if (type->relativeName_ != nullptr)
+    appendUtf8(out, type->relativeName_->array());
+  else
+    out += "<anonymous>";
+}
+
+#if COLLECT_STATISTIC
+// Memory manager statistics. Counters are always compiled in, but only updated while
+// enabled at runtime (see konan.internal.GC.collectStatistics), so that the data could
+// be collected from production binaries.
+class MemoryStatistic {
+ public:
+  // Reference kinds are container tags, and nullptr.
+  static constexpr int kRefKinds = 5;
+  static constexpr int kNullRef = 4;
+  // Allocation size histogram, bucket i counts sizes in [2^(i-1), 2^i).
+  static constexpr int kSizeBuckets = 33;
+
+  struct TypeCounters {
+    uint64_t count;
+    uint64_t bytes;
+  };
+  typedef KStdUnorderedMap<const TypeInfo*, TypeCounters> TypeCountersMap;
+
+  // If counters are updated.
+  bool enabled;
+  // UpdateRef per reference kind counters, [old][new].
+  uint64_t updateCounters[kRefKinds][kRefKinds];
+  uint64_t containerAllocs;
+  uint64_t containerFrees;
+  uint64_t heapObjects;
+  uint64_t heapBytes;
+  uint64_t arenaObjects;
+  uint64_t arenaBytes;
+  uint64_t sizeHistogram[kSizeBuckets];
+  // FreezeSubgraph() calls, and containers they have frozen.
+  uint64_t freezes;
+  uint64_t frozenContainers;
+  // Allocations per type, created once statistics is enabled.
+  TypeCountersMap* typeCounters;
+
+  // Map of reference kind to human readable name.
+  static constexpr const char* indexToName[] = { "normal", "frozen", "permanent", "stack", "null" };
+
+  void init() {
+    enabled = false;
+    typeCounters = nullptr;
+    reset();
+  }
+
+  void deinit() {
+    if (typeCounters != nullptr) {
+      konanDestructInstance(typeCounters);
+      typeCounters = nullptr;
     }
-    konan::consolePrintf("\n");
+  }
 
-    konan::consolePrintf("Allocation histogram:\n");
-    KStdVector<int> keys(allocationHistogram->size());
-    int index = 0;
-    for (auto& it : *allocationHistogram) {
-      keys[index++] = it.first;
+  void setEnabled(bool value) {
+    if (value && typeCounters == nullptr)
+      typeCounters = konanConstructInstance<TypeCountersMap>();
+    enabled = value;
+  }
+
+  void reset() {
+    memset(updateCounters, 0, sizeof(updateCounters));
+    containerAllocs = containerFrees = 0;
+    heapObjects = heapBytes = arenaObjects = arenaBytes = 0;
+    memset(sizeHistogram, 0, sizeof(sizeHistogram));
+    freezes = frozenContainers = 0;
+    if (typeCounters != nullptr) typeCounters->clear();
+  }
+
+  void incUpdateRef(const ObjHeader* objOld, const ObjHeader* objNew) {
+    updateCounters[toIndex(objOld)][toIndex(objNew)]++;
+  }
+
+  void incAlloc(size_t size, const ContainerHeader* header) {
+    containerAllocs++;
+    sizeHistogram[sizeBucket(size)]++;
+  }
+
+  void incFree(const ContainerHeader* header) {
+    containerFrees++;
+  }
+
+  void incAlloc(size_t size, const ObjHeader* obj) {
+    if (obj->container()->stack()) {
+      arenaObjects++;
+      arenaBytes += size;
+    } else {
+      heapObjects++;
+      heapBytes += size;
+    }
+    TypeCounters& counters = (*typeCounters)[obj->type_info()];
+    counters.count++;
+    counters.bytes += size;
+  }
+
+  void incFreeze(size_t containers) {
+    freezes++;
+    frozenContainers += containers;
+  }
+
+  static int toIndex(const ObjHeader* obj) {
+    // Shared instance being initialized is marked with 1, see InitSharedInstance().
+    if (reinterpret_cast<uintptr_t>(obj) <= 1) return kNullRef;
+    return obj->container()->tag();
+  }
+
+  static int sizeBucket(size_t size) {
+    return size == 0 ? 0 : 64 - __builtin_clzll(size);
+  }
+
+  // Appends counters to `out` as JSON object.
+  void toJson(KStdString& out) const {
+    out += "{";
+    appendField(out, "enabled", enabled);
+    out += ",\"containers\":{";
+    appendField(out, "alloc", containerAllocs);
+    out += ",";
+    appendField(out, "free", containerFrees);
+    out += "},\"heap\":{";
+    appendField(out, "objects", heapObjects);
+    out += ",";
+    appendField(out, "bytes", heapBytes);
+    out += "},\"arena\":{";
+    appendField(out, "objects", arenaObjects);
+    out += ",";
+    appendField(out, "bytes", arenaBytes);
+    out += "},\"freeze\":{";
+    appendField(out, "calls", freezes);
+    out += ",";
+    appendField(out, "containers", frozenContainers);
+    // Lock counters are process-wide.
+    LockStatistic locks = GetLockStatistic();
+    out += "},\"locks\":{";
+    appendField(out, "contended", locks.contended);
+    out += ",";
+    appendField(out, "parked", locks.parked);
+    out += "},\"updateRef\":{";
+    bool first = true;
+    for (int i = 0; i < kRefKinds; i++) {
+      for (int j = 0; j < kRefKinds; j++) {
+        if (updateCounters[i][j] == 0) continue;
+        if (!first) out += ",";
+        first = false;
+        KStdString name = KStdString(indexToName[i]) + "->" + indexToName[j];
+        appendField(out, name.c_str(), updateCounters[i][j]);
+      }
     }
-    std::sort(keys.begin(), keys.end());
-    for (auto& it : keys) {
-      konan::consolePrintf(
-          "%d bytes -> %d times\n", it, (*allocationHistogram)[it]);
+    out += "},\"sizeHistogram\":{";
+    first = true;
+    for (int i = 0; i < kSizeBuckets; i++) {
+      if (sizeHistogram[i] == 0) continue;
+      if (!first) out += ",";
+      first = false;
+      char bound[24];
+      konan::snprintf(bound, sizeof(bound), "%llu", static_cast<unsigned long long>(i == 0 ? 0 : 1ULL << (i - 1)));
+      appendField(out, bound, sizeHistogram[i]);
     }
+    out += "},\"types\":[";
+    if (typeCounters != nullptr) {
+      first = true;
+      for (auto& it : *typeCounters) {
+        if (!first) out += ",";
+        first = false;
+        KStdString name;
+        AppendTypeName(name, it.first);
+        out += "{\"name\":\"";
+        for (char c : name) {
+          if (c == '"' || c == '\\') out += '\\';
+          out += c;
+        }
+        out += "\",";
+        appendField(out, "count", it.second.count);
+        out += ",";
+        appendField(out, "bytes", it.second.bytes);
+        out += "}";
+      }
+    }
+    out += "]}";
+  }
 
-#if USE_GC
-    konan::consolePrintf(
-        "alloc cache: %d hits/%d misses\n", allocCacheHit, allocCacheMiss);
-#endif  // USE_GC
+ private:
+  static void appendField(KStdString& out, const char* name, uint64_t value) {
+    char buffer[24];
+    konan::snprintf(buffer, sizeof(buffer), "%llu", static_cast<unsigned long long>(value));
+    out += "\"";
+    out += name;
+    out += "\":";
+    out += buffer;
+  }
+
+  static void appendField(KStdString& out, const char* name, bool value) {
+    out += "\"";
+    out += name;
+    out += "\":";
+    out += value ? "true" : "false";
   }
 };
 
@@ -222,6 +717,45 @@ constexpr const char* MemoryStatistic::indexToName[];
 
 #endif  // COLLECT_STATISTIC
 
+#if USE_GC && GC_EVENT_LOG
+struct GcEvent {
+  // Timestamp of collection start, in microseconds.
+  uint64_t startTime;
+  uint64_t duration;
+  // Release candidates at collection start.
+  uint32_t toFreeSize;
+  // Candidates, which were roots of possibly cyclic garbage.
+  uint32_t rootsSize;
+  uint32_t freedContainers;
+  // Threshold after the collection.
+  uint32_t threshold;
+  // If the collection was limited by pause budget.
+  uint32_t incremental;
+};
+
+// Ring buffer of recent collection events.
+class GcEventLog {
+ public:
+  void add(const GcEvent& event) {
+    events_[next_] = event;
+    next_ = (next_ + 1) % kGcEventLogSize;
+    if (count_ < kGcEventLogSize) count_++;
+  }
+
+  int size() const { return count_; }
+
+  // Events in chronological order.
+  const GcEvent& at(int index) const {
+    return events_[(next_ - count_ + index + kGcEventLogSize) % kGcEventLogSize];
+  }
+
+ private:
+  GcEvent events_[kGcEventLogSize];
+  int next_;
+  int count_;
+};
+#endif  // USE_GC && GC_EVENT_LOG
+
 struct MemoryState {
 #if TRACE_MEMORY
   // Set of all containers.
@@ -242,48 +776,109 @@ struct MemoryState {
    */
   ContainerHeaderList* toFree; // List of all cycle candidates.
   ContainerHeaderList* roots; // Real candidates excluding those with refcount = 0.
+  // Work stack of graph traversals, reused between collections.
+  ContainerHeaderList* traversalStack;
   // How many GC suspend requests happened.
   int gcSuspendCount;
   // How many candidate elements in toFree shall trigger collection.
   size_t gcThreshold;
+  // Pause budget of threshold-triggered collections in microseconds, or 0 if they are not incremental.
+  uint64_t gcPauseBudget;
+  // Candidates left unprocessed by the last incremental collection.
+  size_t gcBacklog;
+  // Number of oldest candidates in toFree, whose subgraphs cannot be marked within pause budget.
+  // Incremental collections skip them, until there are too many.
+  size_t gcOversized;
+  // Containers marked gray by the current incremental marking with their previous colors,
+  // so that marking could be undone once pause budget is exhausted.
+  ContainerColorList* grayLog;
   // If collection is in progress.
   bool gcInProgress;
   int finalizerQueueSuspendCount;
 
 #if GC_ERGONOMICS
   uint64_t lastGcTimestamp;
+  const GcPolicy* gcPolicy;
+#endif
+
+#if GC_EVENT_LOG
+  GcEventLog gcEventLog;
+#endif
+
+#if USE_DEFERRED_RC
+  // Innermost stack frame with deferred slots, frames are linked via their header slots.
+  ObjHeader** deferredFrames;
+  // Normal containers, whose reference counter dropped to zero, but which may still be
+  // referenced from deferred slots.
+  ContainerHeaderList* zeroCountTable;
+  // Zero count table size, triggering reconciliation on frame leave or allocation.
+  size_t zeroCountLimit;
+  // Size of containers added to zero count table since last reconciliation.
+  size_t zeroCountBytes;
+  // If references from deferred slots are currently included into reference counters.
+  bool deferredRefsCounted;
 #endif
 
 #endif // USE_GC
 
+#if USE_CONTAINER_CACHE
+  // Memory of recently freed containers, ready for reuse.
+  ContainerCache containerCache;
+#endif
+
+#if USE_ARENA_POOL
+  // Arena chunks, ready for reuse.
+  ArenaPool arenaPool;
+#endif
+
+#if USE_FROZEN_RC_BUFFER
+  // Pending decrements of frozen containers.
+  FrozenRCBuffer frozenRCBuffer;
+#endif
+
+#if USE_HEAP_BUDGET
+  // Bytes allocated by this state since its last collection.
+  size_t allocatedBytes;
+  // If non-zero, allocations neither collect garbage on heap budget nor fail on the hard limit, as
+  // runtime is in the middle of an operation collection must not interleave with, or throws
+  // OutOfMemoryError. See HeapLimitSuspender.
+  int heapLimitSuspendCount;
+#endif
+
+  // Locations of global and thread-local references of this thread.
+  KRefPtrList* globalRoots;
+
+  // Thread heap serving allocations of this state, or nullptr if global heap is used.
+  void* heap;
+
 #if COLLECT_STATISTIC
-  #define CONTAINER_ALLOC_STAT(state, size, container) state->statistic.incAlloc(size, container);
+  #define CONTAINER_ALLOC_STAT(state, size, container) \
+    if (state->statistic.enabled) state->statistic.incAlloc(size, container);
   #define CONTAINER_FREE_STAT(state, container)
   #define CONTAINER_DESTROY_STAT(state, container) \
-    state->statistic.incFree(container);
+    if (state->statistic.enabled) state->statistic.incFree(container);
   #define OBJECT_ALLOC_STAT(state, size, object) \
-    state->statistic.incAlloc(size, object);
-  #define OBJECT_FREE_STAT(state, size, object) \
-    state->statistic.incFree(object);
-#define UPDATE_REF_STAT(state, oldRef, newRef, slot)         \
-    state->statistic.incUpdateRef(oldRef, newRef);
+    if (state->statistic.enabled) state->statistic.incAlloc(size, object);
+  #define OBJECT_FREE_STAT(state, size, object)
+  #define UPDATE_REF_STAT(state, oldRef, newRef, slot) \
+    if (state->statistic.enabled) state->statistic.incUpdateRef(oldRef, newRef);
+  #define FREEZE_STAT(state, containers) \
+    if (state->statistic.enabled) state->statistic.incFreeze(containers);
   #define INIT_STAT(state) \
     state->statistic.init();
   #define DEINIT_STAT(state) \
     state->statistic.deinit();
-  #define PRINT_STAT(state) \
-    state->statistic.printStatistic();
   MemoryStatistic statistic;
 #else
   #define CONTAINER_ALLOC_STAT(state, size, container)
   #define CONTAINER_FREE_STAT(state, container)
   #define CONTAINER_DESTROY_STAT(state, container)
   #define OBJECT_ALLOC_STAT(state, size, object)
-  #define OBJECT_FREE_STAT(state, object)
+  #define OBJECT_FREE_STAT(state, size, object)
   #define UPDATE_REF_STAT(state, oldRef, newRef, slot)
+  #define FREEZE_STAT(state, containers)
   #define INIT_STAT(state)
   #define DEINIT_STAT(state)
-  #define PRINT_STAT(state)
 #endif // COLLECT_STATISTIC
 };
 
@@ -342,15 +937,38 @@ struct MemoryState {
 #define UPDATE_REF_EVENT(state, oldRef, newRef, slot) \
   UPDATE_REF_STAT(state, oldRef, newRef, slot) \
   UPDATE_REF_TRACE(state, oldRef, newRef, slot)
-// Infomation shall be printed as worker is exiting.
-#define PRINT_EVENT(state) \
-  PRINT_STAT(state)
+// Subgraph with given number of containers was frozen.
+#define FREEZE_EVENT(state, containers) \
+  FREEZE_STAT(state, containers)
 
 namespace {
 
 // TODO: can we pass this variable as an explicit argument?
 THREAD_LOCAL_VARIABLE MemoryState* memoryState = nullptr;
 
+// Suspends heap budget enforcement for the scope, where runtime allocates in the middle of an
+// operation, which collection or exception must not interrupt.
+class HeapLimitSuspender {
+ public:
+  explicit HeapLimitSuspender(MemoryState* state) : state_(state) {
+#if USE_HEAP_BUDGET
+    if (state_ != nullptr) state_->heapLimitSuspendCount++;
+#endif
+  }
+
+  ~HeapLimitSuspender() {
+#if USE_HEAP_BUDGET
+    if (state_ != nullptr) state_->heapLimitSuspendCount--;
+#endif
+  }
+
+ private:
+  MemoryState* state_;
+
+  HeapLimitSuspender(const HeapLimitSuspender&) = delete;
+  HeapLimitSuspender& operator=(const HeapLimitSuspender&) = delete;
+};
+
 constexpr int kFrameOverlaySlots = sizeof(FrameOverlay) / sizeof(ObjHeader**);
 
 inline bool isFreeable(const ContainerHeader* header) {
@@ -380,6 +998,48 @@ inline container_size_t objectSize(const ObjHeader* obj) {
   return alignUp(size, kObjectAlignment);
 }
 
+inline size_t containerSize(const ContainerHeader* container) {
+  size_t result = 0;
+  const ObjHeader* obj = ContainerFirstObject(container);
+  for (int object = 0; object < container->objectCount(); object++) {
+    size_t size = objectSize(obj);
+    result += size;
+    obj = reinterpret_cast<ObjHeader*>(
+        reinterpret_cast<uintptr_t>(obj) + size);
+  }
+  return result;
+}
+
+#if USE_ALIGNED_ARRAYS
+// If payload of the array is aligned to kArrayAlignment. Strings and arrays of references are not.
+inline bool hasAlignedPayload(const TypeInfo* typeInfo, uint32_t dataSize) {
+  return typeInfo->instanceSize_ < 0 && typeInfo != theArrayTypeInfo && typeInfo != theStringTypeInfo &&
+      dataSize >= kArrayAlignment;
+}
+
+inline bool hasAlignedPayload(const ObjHeader* obj) {
+  const TypeInfo* typeInfo = obj->type_info();
+  return typeInfo->instanceSize_ < 0 && hasAlignedPayload(typeInfo, ArrayDataSizeBytes(obj->array()));
+}
+
+// Moves `place` forward, so that data following `headerSize` bytes is aligned to kArrayAlignment.
+inline uint8_t* alignPayload(uint8_t* place, size_t headerSize) {
+  uintptr_t payload = reinterpret_cast<uintptr_t>(place) + headerSize;
+  payload = (payload + kArrayAlignment - 1) & ~static_cast<uintptr_t>(kArrayAlignment - 1);
+  return reinterpret_cast<uint8_t*>(payload - headerSize);
+}
+#endif  // USE_ALIGNED_ARRAYS
+
+// Arena aligns arrays by skipping few zeroed words, and objects of arena containers are to be
+// looked up after them.
+inline ObjHeader* skipPadding(ObjHeader* obj) {
+#if USE_ALIGNED_ARRAYS
+  while (obj->typeInfoOrMeta_ == nullptr)
+    obj = reinterpret_cast<ObjHeader*>(reinterpret_cast<uintptr_t>(obj) + kObjectAlignment);
+#endif
+  return obj;
+}
+
 inline bool isArenaSlot(ObjHeader** slot) {
   return (reinterpret_cast<uintptr_t>(slot) & ARENA_BIT) != 0;
 }
@@ -397,21 +1057,14 @@ inline bool isRefCounted(KConstRef object) {
   return isFreeable(object->container());
 }
 
-inline void lock(KInt* spinlock) {
-  while (compareAndSwap(spinlock, 0, 1) != 0) {}
-}
-
-inline void unlock(KInt* spinlock) {
-  RuntimeCheck(compareAndSwap(spinlock, 1, 0) == 1, "Must succeed");
-}
-
 } // namespace
 
 extern "C" {
 
 // Ensure LLVM never throws theStaticObjectsContainer away.
 // TODO: although practically const, marking it as such makes LLVM crazy, fix it.
-RUNTIME_USED ContainerHeader theStaticObjectsContainer = {
+// Container pointers must not look like inline headers, see CONTAINER_TAG_INLINE.
+RUNTIME_USED __attribute__((aligned(8))) ContainerHeader theStaticObjectsContainer = {
   CONTAINER_TAG_PERMANENT | CONTAINER_TAG_INCREMENT,
   0 /* Object count */
 };
@@ -423,9 +1076,10 @@ RUNTIME_NORETURN void ThrowFreezingException(KRef toFreeze, KRef blocker);
 }  // extern "C"
 
 inline void runDeallocationHooks(ContainerHeader* container) {
-  ObjHeader* obj = reinterpret_cast<ObjHeader*>(container + 1);
+  ObjHeader* obj = ContainerFirstObject(container);
 
   for (int index = 0; index < container->objectCount(); index++) {
+    obj = skipPadding(obj);
     if (obj->has_meta_object()) {
       ObjHeader::destroyMetaObject(&obj->typeInfoOrMeta_);
     }
@@ -445,23 +1099,29 @@ void DeinitInstanceBody(const TypeInfo* typeInfo, void* body) {
 
 namespace {
 
+template<typename func>
+inline void traverseObjectFields(ObjHeader* obj, func process) {
+  const TypeInfo* typeInfo = obj->type_info();
+  if (typeInfo != theArrayTypeInfo) {
+    for (int index = 0; index < typeInfo->objOffsetsCount_; index++) {
+      ObjHeader** location = reinterpret_cast<ObjHeader**>(
+          reinterpret_cast<uintptr_t>(obj + 1) + typeInfo->objOffsets_[index]);
+      process(location);
+    }
+  } else {
+    ArrayHeader* array = obj->array();
+    for (int index = 0; index < array->count_; index++) {
+      process(ArrayAddressOfElementAt(array, index));
+    }
+  }
+}
+
 template<typename func>
 inline void traverseContainerObjectFields(ContainerHeader* container, func process) {
-  ObjHeader* obj = reinterpret_cast<ObjHeader*>(container + 1);
+  ObjHeader* obj = ContainerFirstObject(container);
   for (int object = 0; object < container->objectCount(); object++) {
-    const TypeInfo* typeInfo = obj->type_info();
-    if (typeInfo != theArrayTypeInfo) {
-      for (int index = 0; index < typeInfo->objOffsetsCount_; index++) {
-        ObjHeader** location = reinterpret_cast<ObjHeader**>(
-            reinterpret_cast<uintptr_t>(obj + 1) + typeInfo->objOffsets_[index]);
-        process(location);
-      }
-    } else {
-      ArrayHeader* array = obj->array();
-      for (int index = 0; index < array->count_; index++) {
-        process(ArrayAddressOfElementAt(array, index));
-      }
-    }
+    obj = skipPadding(obj);
+    traverseObjectFields(obj, process);
     obj = reinterpret_cast<ObjHeader*>(
       reinterpret_cast<uintptr_t>(obj) + objectSize(obj));
   }
@@ -485,8 +1145,90 @@ inline ContainerHeader* markAsRemoved(ContainerHeader* container) {
   return reinterpret_cast<ContainerHeader*>(reinterpret_cast<uintptr_t>(container) | 1);
 }
 
-inline void processFinalizerQueue(MemoryState* state) {
-  // TODO: reuse elements of finalizer queue for new allocations.
+#endif  // USE_GC
+
+#if USE_LARGE_ARRAYS
+/**
+ * Large array container is placed in its own memory mapping, so that array elements
+ * start at the page boundary:
+ *   | padding | ContainerHeader | ArrayHeader | elements ... |
+ *                                            ^ page boundary
+ * With compact objects the container header is inline, in the ArrayHeader.
+ */
+inline size_t largeArrayMappingSize(size_t dataSize) {
+  size_t pageSize = konan::memoryPageSize();
+  return pageSize + ((dataSize + pageSize - 1) & ~(pageSize - 1));
+}
+
+inline bool isLargeArrayContainer(const ContainerHeader* container, size_t size) {
+  return size >= kLargeArrayThreshold && ContainerFirstObject(container)->type_info()->instanceSize_ < 0;
+}
+
+// Returns memory of the container, to be turned into the container header with containerAt().
+inline void* allocLargeArrayContainer(size_t dataSize) {
+  size_t pageSize = konan::memoryPageSize();
+  size_t mappingSize = largeArrayMappingSize(dataSize);
+  uint8_t* mapping = reinterpret_cast<uint8_t*>(konan::mapMemory(mappingSize));
+  if (mapping == nullptr) return nullptr;
+  if (dataSize >= kHugePageArrayThreshold)
+    konan::adviseHugePages(mapping + pageSize, mappingSize - pageSize);
+  // Mapped memory is already zeroed.
+  return mapping + pageSize - sizeof(ArrayHeader) - kObjectContainerHeaderSize;
+}
+
+inline void freeLargeArrayContainer(ContainerHeader* container) {
+  const ArrayHeader* array = ContainerFirstObject(container)->array();
+  const uint8_t* mapping = reinterpret_cast<const uint8_t*>(array + 1) - konan::memoryPageSize();
+  konan::unmapMemory(const_cast<uint8_t*>(mapping), largeArrayMappingSize(ArrayDataSizeBytes(array)));
+}
+#endif  // USE_LARGE_ARRAYS
+
+// Releases memory of the dead container, keeping it in the container cache when possible.
+inline void freeContainerMemory(MemoryState* state, ContainerHeader* container) {
+  // Aggregating frozen containers hold no objects, only pointers to their component containers.
+  if (isAggregatingFrozenContainer(container)) {
+#if USE_HEAP_BUDGET
+    atomicAdd(&heapBytes, -(sizeof(ContainerHeader) + sizeof(ContainerHeader*) * container->objectCount()));
+#endif
+    konanFreeMemory(container);
+    return;
+  }
+  size_t size = containerSize(container);
+  uint8_t* memory = reinterpret_cast<uint8_t*>(container);
+  if (container->inlined())
+    memory = reinterpret_cast<uint8_t*>(ContainerFirstObject(container));
+  else
+    size += sizeof(ContainerHeader);
+#if USE_LARGE_ARRAYS
+  if (isLargeArrayContainer(container, size)) {
+#if USE_HEAP_BUDGET
+    atomicAdd(&heapBytes, -size);
+#endif
+    freeLargeArrayContainer(container);
+    return;
+  }
+#endif
+#if USE_ALIGNED_ARRAYS
+  // See allocAlignedArrayContainer().
+  if (hasAlignedPayload(ContainerFirstObject(container))) {
+    memory -= reinterpret_cast<uintptr_t*>(memory)[-1];
+    size += kArrayAlignment;
+  }
+#endif
+#if USE_HEAP_BUDGET
+  atomicAdd(&heapBytes, -size);
+#endif
+#if USE_CONTAINER_CACHE
+  state->containerCache.free(memory, size);
+#else
+  konanFreeMemory(memory);
+#endif
+}
+
+#if USE_GC
+// Returns number of destroyed containers.
+inline size_t processFinalizerQueue(MemoryState* state) {
+  size_t result = 0;
   while (!state->finalizerQueue->empty()) {
     auto container = memoryState->finalizerQueue->back();
     state->finalizerQueue->pop_back();
@@ -494,9 +1236,11 @@ inline void processFinalizerQueue(MemoryState* state) {
     state->containers->erase(container);
 #endif
     CONTAINER_DESTROY_EVENT(state, container)
-    konanFreeMemory(container);
+    freeContainerMemory(state, container);
     atomicAdd(&allocCount, -1);
+    result++;
   }
+  return result;
 }
 #endif
 
@@ -511,7 +1255,7 @@ inline void scheduleDestroyContainer(
 #else
   atomicAdd(&allocCount, -1);
   CONTAINER_DESTROY_EVENT(state, container)
-  konanFreeMemory(container);
+  freeContainerMemory(state, container);
 #endif
 }
 
@@ -536,6 +1280,15 @@ inline uint32_t freeableSize(MemoryState* state) {
   return state->toFree->size();
 }
 
+inline bool needsCollection(MemoryState* state) {
+  if (state->gcBacklog == 0)
+    return freeableSize(state) >= state->gcThreshold;
+  // Once incremental collection falls behind, next slice is due sooner.
+  return freeableSize(state) >= state->gcBacklog + std::min(kGcSliceCandidates, state->gcThreshold);
+}
+
+void GarbageCollectOnThreshold(MemoryState* state);
+
 template <bool Atomic>
 inline void IncrementRC(ContainerHeader* container) {
   container->incRefCount<Atomic>();
@@ -545,6 +1298,15 @@ inline void IncrementRC(ContainerHeader* container) {
 template <bool Atomic>
 inline void DecrementRC(ContainerHeader* container, bool useCycleCollector) {
   if (container->decRefCount<Atomic>() == 0) {
+#if USE_DEFERRED_RC
+    auto state = memoryState;
+    if (!Atomic && !state->deferredRefsCounted) {
+      // Could still be referenced from deferred slots, so decide on reconciliation.
+      state->zeroCountTable->push_back(container);
+      state->zeroCountBytes += containerSize(container);
+      return;
+    }
+#endif
     FreeContainer(container);
   } else if (!Atomic && useCycleCollector) { // Possible root.
     // Do not use cycle collector for frozen objects, as we already detected possible cycles during
@@ -555,8 +1317,8 @@ inline void DecrementRC(ContainerHeader* container, bool useCycleCollector) {
         container->setBuffered();
         auto state = memoryState;
         state->toFree->push_back(container);
-        if (state->gcSuspendCount == 0 && freeableSize(state) >= state->gcThreshold) {
-          GarbageCollect();
+        if (state->gcSuspendCount == 0 && needsCollection(state)) {
+          GarbageCollectOnThreshold(state);
         }
       }
     }
@@ -565,10 +1327,135 @@ inline void DecrementRC(ContainerHeader* container, bool useCycleCollector) {
 
 inline void initThreshold(MemoryState* state, uint32_t gcThreshold) {
   state->gcThreshold = gcThreshold;
-  state->toFree->reserve(gcThreshold);
+  auto toFree = state->toFree;
+  if (toFree->capacity() > 2 * gcThreshold && toFree->size() <= gcThreshold) {
+    // Give away memory of candidates buffer, once threshold went down.
+    ContainerHeaderList(*toFree).swap(*toFree);
+  }
+  toFree->reserve(gcThreshold);
+}
+
+#if GC_ERGONOMICS
+const GcPolicy* selectGcPolicy() {
+  const char* name = konan::getEnv("KONAN_GC_POLICY");
+  if (name != nullptr) {
+    for (const auto& policy : kGcPolicies) {
+      if (strcmp(name, policy.name) == 0) return &policy;
+    }
+  }
+  return &kGcPolicies[0];
 }
+
+void adjustThreshold(MemoryState* state, uint64_t pause, uint64_t sinceLastGc) {
+  auto policy = state->gcPolicy;
+  double gcShare = double(pause) / (sinceLastGc + 1);
+  size_t threshold = state->gcThreshold;
+  if (pause > policy->targetPause || gcShare < policy->targetGcShare / 4)
+    threshold = threshold * 2 / 3;
+  else if (gcShare > policy->targetGcShare)
+    threshold = threshold * 3 / 2 + 1;
+  threshold = std::max(policy->minThreshold, std::min(policy->maxThreshold, threshold));
+  if (threshold != state->gcThreshold) {
+    MEMORY_LOG("Adjusting GC threshold to %d\n", threshold);
+    initThreshold(state, threshold);
+  }
+}
+#endif  // GC_ERGONOMICS
 #endif // USE_GC
 
+// Deferred frame starts with header slots: link to the outer deferred frame and number of slots.
+constexpr int kDeferredFrameLinkSlot = 0;
+constexpr int kDeferredFrameCountSlot = 1;
+constexpr int kDeferredFrameHeaderSlots = 2;
+
+#if USE_DEFERRED_RC
+
+template <typename func>
+inline void traverseDeferredRefs(MemoryState* state, func process) {
+  for (ObjHeader** frame = state->deferredFrames; frame != nullptr;
+       frame = reinterpret_cast<ObjHeader**>(frame[kDeferredFrameLinkSlot])) {
+    int count = static_cast<int>(reinterpret_cast<uintptr_t>(frame[kDeferredFrameCountSlot]));
+    for (int index = kDeferredFrameHeaderSlots; index < count; index++) {
+      ObjHeader* object = frame[index];
+      // References to frozen objects are always counted, and to stack or permanent ones never.
+      if (object != nullptr && object->container()->normal())
+        process(object->container());
+    }
+  }
+}
+
+// Includes references from deferred slots into reference counters, and frees containers left in
+// zero count table with no references.
+void beginCountingDeferredRefs(MemoryState* state) {
+  RuntimeAssert(!state->deferredRefsCounted, "Deferred references are already counted");
+#if USE_HEAP_BUDGET
+  // Counters are inconsistent until endCountingDeferredRefs(), so nothing may collect meanwhile.
+  state->heapLimitSuspendCount++;
+#endif
+  traverseDeferredRefs(state, [](ContainerHeader* container) {
+    container->incRefCount<false>();
+  });
+  state->deferredRefsCounted = true;
+
+  auto& table = *state->zeroCountTable;
+  if (table.empty()) return;
+  std::sort(table.begin(), table.end());
+  table.erase(std::unique(table.begin(), table.end()), table.end());
+  // Containers referenced again survive. Others are unreachable, so freeing one of them
+  // cannot free another, and all could be freed in any order.
+  table.erase(std::remove_if(table.begin(), table.end(), [](ContainerHeader* container) {
+    return container->refCount() != 0;
+  }), table.end());
+  state->gcSuspendCount++;
+  for (auto container : table)
+    FreeContainer(container);
+  state->gcSuspendCount--;
+  table.clear();
+}
+
+// Excludes references from deferred slots from reference counters again, containers only
+// referenced from deferred slots go to zero count table.
+void endCountingDeferredRefs(MemoryState* state) {
+  RuntimeAssert(state->deferredRefsCounted, "Deferred references are not counted");
+  state->deferredRefsCounted = false;
+#if USE_HEAP_BUDGET
+  state->heapLimitSuspendCount--;
+#endif
+  auto& table = *state->zeroCountTable;
+  traverseDeferredRefs(state, [&table](ContainerHeader* container) {
+    if (container->decRefCount<false>() == 0)
+      table.push_back(container);
+  });
+  state->zeroCountLimit = table.size() + kZeroCountTableThreshold;
+  state->zeroCountBytes = 0;
+}
+
+void reconcileZeroCountTable(MemoryState* state) {
+  MEMORY_LOG("Reconcile zero count table of %d entries\n", state->zeroCountTable->size())
+  beginCountingDeferredRefs(state);
+  endCountingDeferredRefs(state);
+  // Memory of freed containers is released right away, as reconciliation could be triggered by their size.
+  if (!state->gcInProgress && state->finalizerQueueSuspendCount == 0)
+    processFinalizerQueue(state);
+}
+
+// Allocation is a safe point, which is reached even if frames holding garbage are never left.
+inline void reconcileZeroCountTableOnAllocation(MemoryState* state) {
+  if ((state->zeroCountBytes >= kZeroCountTableMaxBytes || state->zeroCountTable->size() >= state->zeroCountLimit) &&
+      !state->deferredRefsCounted) {
+    reconcileZeroCountTable(state);
+  }
+}
+
+// Drops entries of containers, which are not managed by reference counting of this thread anymore.
+template <typename func>
+inline void purgeZeroCountTable(MemoryState* state, func predicate) {
+  auto& table = *state->zeroCountTable;
+  table.erase(std::remove_if(table.begin(), table.end(), predicate), table.end());
+}
+
+#endif  // USE_DEFERRED_RC
+
 #if TRACE_MEMORY || USE_GC
 
 void dumpWorker(const char* prefix, ContainerHeader* header, ContainerHeaderSet* seen) {
@@ -597,77 +1484,298 @@ void dumpReachable(const char* prefix, const ContainerHeaderSet* roots) {
 
 #endif
 
-void MarkRoots(MemoryState*);
+/**
+ * Heap dump format. All integers are unsigned and written in the byte order of the target,
+ * which could be recognized by the version field. Identifiers are addresses in memory.
+ *
+ *   header:    "KNHD" u32 version (1)
+ *   records:   u8 tag, followed by record body
+ *     1 type:      u64 id, u32 name length, UTF-8 fully qualified name
+ *     2 container: u64 id, u8 container tag (0 - normal, 1 - frozen, 2 - permanent, 3 - stack),
+ *                  u32 reference count, u32 object count
+ *     3 object:    u64 id, u64 container id, u64 type id, u32 size in bytes,
+ *                  u32 reference count n, n x u64 id of referred object
+ *     4 root:      u64 object id
+ *     0 end of dump
+ *
+ * Roots are global and thread-local references of the dumping thread and its local variables, root
+ * records precede all other records. Type and container records always precede objects referring to them. Objects of aggregating
+ * frozen containers (formed by freezing cyclic graphs) refer to the aggregating container, and its
+ * object count is the number of aggregated containers.
+ */
+class HeapDumpWriter {
+ public:
+  enum RecordTag {
+    kEnd = 0,
+    kType = 1,
+    kContainer = 2,
+    kObject = 3,
+    kRoot = 4
+  };
+
+  explicit HeapDumpWriter(int file) : file_(file), failed_(false) {
+    buffer_.reserve(kBufferSize);
+  }
+
+  // Dumps objects reachable from global references and local variables of the current thread.
+  bool dump(MemoryState* state) {
+    writeBytes("KNHD", 4);
+    writeU32(kHeapDumpVersion);
+    KStdVector<ObjHeader*> toVisit;
+    for (auto location : *state->globalRoots) {
+      addRoot(*location, toVisit);
+    }
+#if USE_GC && USE_DEFERRED_RC
+    for (ObjHeader** frame = state->deferredFrames; frame != nullptr;
+         frame = reinterpret_cast<ObjHeader**>(frame[kDeferredFrameLinkSlot])) {
+      int count = static_cast<int>(reinterpret_cast<uintptr_t>(frame[kDeferredFrameCountSlot]));
+      for (int index = kDeferredFrameHeaderSlots; index < count; index++)
+        addRoot(frame[index], toVisit);
+    }
+#endif
+    while (!toVisit.empty()) {
+      ObjHeader* obj = toVisit.back();
+      toVisit.pop_back();
+      writeObject(obj, toVisit);
+    }
+    writeU8(kEnd);
+    flush();
+    return !failed_;
+  }
+
+ private:
+  static constexpr uint32_t kHeapDumpVersion = 1;
+  static constexpr size_t kBufferSize = 64 * 1024;
+
+  void addRoot(ObjHeader* obj, KStdVector<ObjHeader*>& toVisit) {
+    if (obj == nullptr || !seenRoots_.insert(obj).second) return;
+    writeU8(kRoot);
+    writeId(obj);
+    if (seenObjects_.insert(obj).second) toVisit.push_back(obj);
+  }
+
+  void writeObject(ObjHeader* obj, KStdVector<ObjHeader*>& toVisit) {
+    const TypeInfo* type = obj->type_info();
+    if (seenTypes_.insert(type).second) {
+      KStdString name;
+      AppendTypeName(name, type);
+      writeU8(kType);
+      writeId(type);
+      writeU32(name.size());
+      writeBytes(name.data(), name.size());
+    }
+    ContainerHeader* container = obj->container();
+    if (seenContainers_.insert(container).second) {
+      writeU8(kContainer);
+      writeId(container);
+      writeU8(container->tag());
+      writeU32(container->refCount());
+      writeU32(container->objectCount());
+    }
+    refs_.clear();
+    traverseObjectFields(obj, [this, &toVisit](ObjHeader** location) {
+      ObjHeader* ref = *location;
+      if (ref == nullptr) return;
+      refs_.push_back(ref);
+      if (seenObjects_.insert(ref).second) toVisit.push_back(ref);
+    });
+    writeU8(kObject);
+    writeId(obj);
+    writeId(container);
+    writeId(type);
+    writeU32(objectSize(obj));
+    writeU32(refs_.size());
+    for (auto ref : refs_) writeId(ref);
+  }
+
+  void writeBytes(const void* data, size_t size) {
+    if (buffer_.size() + size > kBufferSize) flush();
+    const char* bytes = reinterpret_cast<const char*>(data);
+    buffer_.insert(buffer_.end(), bytes, bytes + size);
+  }
+
+  void writeU8(uint8_t value) { writeBytes(&value, sizeof(value)); }
+  void writeU32(uint32_t value) { writeBytes(&value, sizeof(value)); }
+
+  void writeId(const void* pointer) {
+    uint64_t value = reinterpret_cast<uintptr_t>(pointer);
+    writeBytes(&value, sizeof(value));
+  }
+
+  void flush() {
+    if (!failed_ && !buffer_.empty())
+      failed_ = !konan::writeFile(file_, buffer_.data(), buffer_.size());
+    buffer_.clear();
+  }
+
+  int file_;
+  bool failed_;
+  KStdVector<char> buffer_;
+  KStdVector<ObjHeader*> refs_;
+  KStdUnorderedSet<const ObjHeader*> seenRoots_;
+  KStdUnorderedSet<const ObjHeader*> seenObjects_;
+  KStdUnorderedSet<const TypeInfo*> seenTypes_;
+  KStdUnorderedSet<const ContainerHeader*> seenContainers_;
+};
+
+constexpr uint32_t HeapDumpWriter::kHeapDumpVersion;
+constexpr size_t HeapDumpWriter::kBufferSize;
+
+// Writes the live heap of the current thread to the file at `path`.
+bool dumpHeap(const char* path) {
+  int file = konan::openFileForWriting(path);
+  if (file < 0) return false;
+  bool result;
+  {
+    HeapDumpWriter writer(file);
+    result = writer.dump(memoryState);
+  }
+  konan::closeFile(file);
+  return result;
+}
+
+size_t MarkRoots(MemoryState*, size_t first, size_t last, uint64_t deadline);
 void DeleteCorpses(MemoryState*);
 void ScanRoots(MemoryState*);
 void CollectRoots(MemoryState*);
 
+// Graph traversals below use explicit work stack instead of recursion, so that long chains
+// of containers cannot overflow the native stack. Stack is shared by nested traversals,
+// each one only works above the depth it has started at.
+
+// Pops container to process next, and prefetches the one after it.
+inline ContainerHeader* popContainer(ContainerHeaderList& stack) {
+  ContainerHeader* result = stack.back();
+  stack.pop_back();
+  if (!stack.empty()) __builtin_prefetch(stack.back());
+  return result;
+}
+
+// Excludes references from marked container from counters of its children.
 template<bool useColor>
-void MarkGray(ContainerHeader* container) {
-  if (useColor) {
-    if (container->color() == CONTAINER_TAG_GC_GRAY) return;
-  } else {
-    if (container->marked()) return;
-  }
-  if (useColor) {
-    container->setColor(CONTAINER_TAG_GC_GRAY);
-  } else {
-    container->mark();
-  }
-  traverseContainerReferredObjects(container, [](ObjHeader* ref) {
+inline void markGrayChildren(ContainerHeaderList& stack, ContainerHeader* container) {
+  traverseContainerReferredObjects(container, [&stack](ObjHeader* ref) {
     auto childContainer = ref->container();
     RuntimeAssert(!isArena(childContainer), "A reference to local object is encountered");
 
     if (!childContainer->permanentOrFrozen()) {
       childContainer->decRefCount<false>();
-      MarkGray<useColor>(childContainer);
+      if (useColor ? childContainer->color() != CONTAINER_TAG_GC_GRAY : !childContainer->marked())
+        stack.push_back(childContainer);
     }
   });
 }
 
-void Scan(ContainerHeader* container);
+template<bool useColor>
+void MarkGray(ContainerHeaderList& stack, ContainerHeader* root) {
+  size_t base = stack.size();
+  stack.push_back(root);
+  while (stack.size() > base) {
+    auto container = popContainer(stack);
+    if (useColor) {
+      if (container->color() == CONTAINER_TAG_GC_GRAY) continue;
+      container->setColor(CONTAINER_TAG_GC_GRAY);
+    } else {
+      if (container->marked()) continue;
+      container->mark();
+    }
+    markGrayChildren<useColor>(stack, container);
+  }
+}
+
+// MarkGray() of incremental collection, which gives up once `deadline` is passed, restoring colors
+// and counters of containers it has marked. Returns false in that case. Later phases of the collection
+// only visit gray containers, so bounding marking bounds the whole slice.
+bool MarkGrayBounded(MemoryState* state, ContainerHeader* root, uint64_t deadline) {
+  auto& stack = *state->traversalStack;
+  auto& log = *state->grayLog;
+  size_t base = stack.size();
+  stack.push_back(root);
+  while (stack.size() > base) {
+    auto container = popContainer(stack);
+    if (container->color() == CONTAINER_TAG_GC_GRAY) continue;
+    log.push_back(std::make_pair(container, container->color()));
+    container->setColor(CONTAINER_TAG_GC_GRAY);
+    markGrayChildren<true>(stack, container);
+    if (log.size() % kGcMarkCheckInterval == 0 && konan::getTimeMicros() >= deadline) {
+      stack.resize(base);
+      for (auto& entry : log) {
+        traverseContainerReferredObjects(entry.first, [](ObjHeader* ref) {
+          auto childContainer = ref->container();
+          if (!childContainer->permanentOrFrozen())
+            childContainer->incRefCount<false>();
+        });
+        entry.first->setColor(entry.second);
+      }
+      log.clear();
+      return false;
+    }
+  }
+  log.clear();
+  return true;
+}
 
 template<bool useColor>
-void ScanBlack(ContainerHeader* container) {
+void ScanBlack(ContainerHeaderList& stack, ContainerHeader* root) {
+  size_t base = stack.size();
   if (useColor) {
-    container->setColor(CONTAINER_TAG_GC_BLACK);
+    root->setColor(CONTAINER_TAG_GC_BLACK);
   } else {
-    container->unMark();
-  }
-  traverseContainerReferredObjects(container, [](ObjHeader* ref) {
-    auto childContainer = ref->container();
-    RuntimeAssert(!isArena(childContainer), "A reference to local object is encountered");
-    if (!childContainer->permanentOrFrozen()) {
-      childContainer->incRefCount<false>();
-      if (useColor) {
-        if (childContainer->color() != CONTAINER_TAG_GC_BLACK)
-          ScanBlack<useColor>(childContainer);
-      } else {
-        if (childContainer->marked())
-          ScanBlack<useColor>(childContainer);
+    root->unMark();
+  }
+  stack.push_back(root);
+  while (stack.size() > base) {
+    auto container = popContainer(stack);
+    traverseContainerReferredObjects(container, [&stack](ObjHeader* ref) {
+      auto childContainer = ref->container();
+      RuntimeAssert(!isArena(childContainer), "A reference to local object is encountered");
+      if (!childContainer->permanentOrFrozen()) {
+        childContainer->incRefCount<false>();
+        if (useColor) {
+          if (childContainer->color() == CONTAINER_TAG_GC_BLACK) return;
+          childContainer->setColor(CONTAINER_TAG_GC_BLACK);
+        } else {
+          if (!childContainer->marked()) return;
+          childContainer->unMark();
+        }
+        stack.push_back(childContainer);
       }
-    }
-  });
+    });
+  }
 }
 
+void Scan(ContainerHeaderList& stack, ContainerHeader* root);
 void CollectWhite(MemoryState*, ContainerHeader* container);
 
-void CollectCycles(MemoryState* state) {
-  MarkRoots(state);
+// Collects cycles among last `candidates` elements of toFree and removes processed ones from the list.
+// Once `deadline` is passed, candidate being marked and following ones are left in the list, with
+// `interrupted` set. Returns number of candidates, which were cycle roots.
+size_t CollectCycles(MemoryState* state, size_t candidates, uint64_t deadline, bool* interrupted) {
+  size_t first = state->toFree->size() - candidates;
+  size_t last = MarkRoots(state, first, first + candidates, deadline);
+  *interrupted = last < first + candidates;
   ScanRoots(state);
   CollectRoots(state);
-  state->toFree->clear();
+  size_t roots = state->roots->size();
+  state->toFree->erase(state->toFree->begin() + first, state->toFree->begin() + last);
   state->roots->clear();
+  return roots;
 }
 
-void MarkRoots(MemoryState* state) {
-  for (auto container : *(state->toFree)) {
+// Returns index of the first candidate, which was not processed because of passed deadline.
+size_t MarkRoots(MemoryState* state, size_t first, size_t last, uint64_t deadline) {
+  for (size_t index = first; index < last; index++) {
+    auto container = (*state->toFree)[index];
     if (isMarkedAsRemoved(container))
       continue;
     auto color = container->color();
     auto rcIsZero = container->refCount() == 0;
     if (color == CONTAINER_TAG_GC_PURPLE && !rcIsZero) {
-      MarkGray<true>(container);
+      if (deadline == kGcNoDeadline) {
+        MarkGray<true>(*state->traversalStack, container);
+      } else if (!MarkGrayBounded(state, container, deadline)) {
+        return index;
+      }
       state->roots->push_back(container);
     } else {
       container->resetBuffered();
@@ -676,54 +1784,154 @@ void MarkRoots(MemoryState* state) {
       }
     }
   }
+  return last;
 }
 
 void ScanRoots(MemoryState* state) {
   for (auto container : *(state->roots)) {
-    Scan(container);
+    Scan(*state->traversalStack, container);
   }
 }
 
 void CollectRoots(MemoryState* state) {
+  // Roots are unbuffered first, so that only candidates outside of the current slice are seen as buffered.
   for (auto container : *(state->roots)) {
     container->resetBuffered();
+  }
+  for (auto container : *(state->roots)) {
     CollectWhite(state, container);
   }
 }
 
-void Scan(ContainerHeader* container) {
-  if (container->color() != CONTAINER_TAG_GC_GRAY) return;
-  if (container->refCount() != 0) {
-    ScanBlack<true>(container);
-    return;
-  }
-  container->setColor(CONTAINER_TAG_GC_WHITE);
-  traverseContainerReferredObjects(container, [](ObjHeader* ref) {
-    auto childContainer = ref->container();
-    RuntimeAssert(!isArena(childContainer), "A reference to local object is encountered");
-    if (!childContainer->permanentOrFrozen()) {
-      Scan(childContainer);
+void Scan(ContainerHeaderList& stack, ContainerHeader* root) {
+  size_t base = stack.size();
+  stack.push_back(root);
+  while (stack.size() > base) {
+    auto container = popContainer(stack);
+    if (container->color() != CONTAINER_TAG_GC_GRAY) continue;
+    if (container->refCount() != 0) {
+      ScanBlack<true>(stack, container);
+      continue;
     }
-  });
+    container->setColor(CONTAINER_TAG_GC_WHITE);
+    traverseContainerReferredObjects(container, [&stack](ObjHeader* ref) {
+      auto childContainer = ref->container();
+      RuntimeAssert(!isArena(childContainer), "A reference to local object is encountered");
+      if (!childContainer->permanentOrFrozen() && childContainer->color() == CONTAINER_TAG_GC_GRAY) {
+        stack.push_back(childContainer);
+      }
+    });
+  }
 }
 
-void CollectWhite(MemoryState* state, ContainerHeader* container) {
-  if (container->color() != CONTAINER_TAG_GC_WHITE || container->buffered())
-    return;
-  container->setColor(CONTAINER_TAG_GC_BLACK);
-  traverseContainerObjectFields(container, [state](ObjHeader** location) {
-    auto ref = *location;
-    if (ref == nullptr) return;
-    auto childContainer = ref->container();
-    RuntimeAssert(!isArena(childContainer), "A reference to local object is encountered");
-    if (childContainer->permanentOrFrozen()) {
-      UpdateRef(location, nullptr);
-    } else {
-      CollectWhite(state, childContainer);
+void CollectWhite(MemoryState* state, ContainerHeader* root) {
+  auto& stack = *state->traversalStack;
+  size_t base = stack.size();
+  stack.push_back(root);
+  while (stack.size() > base) {
+    auto container = popContainer(stack);
+    if (container->color() != CONTAINER_TAG_GC_WHITE) continue;
+    container->setColor(CONTAINER_TAG_GC_BLACK);
+    traverseContainerObjectFields(container, [&stack](ObjHeader** location) {
+      auto ref = *location;
+      if (ref == nullptr) return;
+      auto childContainer = ref->container();
+      RuntimeAssert(!isArena(childContainer), "A reference to local object is encountered");
+      if (childContainer->permanentOrFrozen()) {
+        UpdateRef(location, nullptr);
+      } else if (childContainer->color() == CONTAINER_TAG_GC_WHITE) {
+        stack.push_back(childContainer);
+      }
+    });
+    runDeallocationHooks(container);
+    // Candidate not yet processed by incremental collection is still referenced from toFree.
+    // Like in FreeContainer(), it's left black with zero refcount for MarkRoots() to destroy.
+    if (!container->buffered())
+      scheduleDestroyContainer(state, container);
+  }
+}
+
+// Collects cycle candidates, newest first. Incremental collection stops once pause budget
+// is exhausted, leaving remaining candidates buffered for the next collection. Candidate, which
+// cannot be marked even within the whole budget, is set aside for non-incremental collection.
+void collectGarbage(MemoryState* state, bool incremental) {
+  RuntimeAssert(!state->gcInProgress, "Recursive GC is disallowed");
+
+  if (incremental && state->gcOversized >= kGcOversizedCandidates)
+    incremental = false;
+
+  MEMORY_LOG("Garbage collect\n")
+
+#if USE_FROZEN_RC_BUFFER
+  // Collection is a safe point to merge counters of frozen objects.
+  state->frozenRCBuffer.flush();
+#endif
+
+  auto gcStartTime = konan::getTimeMicros();
+  size_t toFreeSize = state->toFree->size();
+  size_t rootsSize = 0;
+
+#if USE_DEFERRED_RC
+  // Containers only referenced from deferred slots must be seen as referenced during collection.
+  beginCountingDeferredRefs(state);
+#endif
+
+  state->gcInProgress = true;
+
+  size_t freedContainers = processFinalizerQueue(state);
+
+  if (!incremental)
+    state->gcOversized = 0;
+  uint64_t deadline = incremental ? gcStartTime + state->gcPauseBudget : kGcNoDeadline;
+  while (state->toFree->size() > state->gcOversized) {
+    size_t candidates = state->toFree->size() - state->gcOversized;
+    if (incremental && candidates > kGcSliceCandidates)
+      candidates = kGcSliceCandidates;
+    size_t first = state->toFree->size() - candidates;
+    bool interrupted = false;
+    size_t roots = CollectCycles(state, candidates, deadline, &interrupted);
+    if (interrupted && rootsSize == 0 && roots == 0) {
+      // Interrupted candidate is now at `first`, move it to oversized ones.
+      auto& toFree = *state->toFree;
+      std::swap(toFree[first], toFree[state->gcOversized]);
+      state->gcOversized++;
     }
-  });
-  runDeallocationHooks(container);
-  scheduleDestroyContainer(state, container);
+    rootsSize += roots;
+    freedContainers += processFinalizerQueue(state);
+    if (incremental && konan::getTimeMicros() >= deadline)
+      break;
+  }
+  state->gcBacklog = state->toFree->size();
+#if USE_HEAP_BUDGET
+  state->allocatedBytes = 0;
+#endif
+
+  state->gcInProgress = false;
+
+#if USE_DEFERRED_RC
+  endCountingDeferredRefs(state);
+#endif
+
+#if GC_ERGONOMICS || GC_EVENT_LOG
+  auto gcEndTime = konan::getTimeMicros();
+#endif
+#if GC_ERGONOMICS
+  adjustThreshold(state, gcEndTime - gcStartTime, gcEndTime - state->lastGcTimestamp);
+  MEMORY_LOG("Garbage collect: GC length=%lld sinceLast=%lld\n",
+             (gcEndTime - gcStartTime), gcStartTime - state->lastGcTimestamp);
+  state->lastGcTimestamp = gcEndTime;
+#endif
+#if GC_EVENT_LOG
+  GcEvent event = {
+    gcStartTime, gcEndTime - gcStartTime, static_cast<uint32_t>(toFreeSize), static_cast<uint32_t>(rootsSize),
+    static_cast<uint32_t>(freedContainers), static_cast<uint32_t>(state->gcThreshold), incremental
+  };
+  state->gcEventLog.add(event);
+#endif
+}
+
+void GarbageCollectOnThreshold(MemoryState* state) {
+  collectGarbage(state, state->gcPauseBudget > 0);
 }
 
 inline void AddRef(ContainerHeader* header) {
@@ -737,6 +1945,10 @@ inline void AddRef(ContainerHeader* header) {
       IncrementRC<false>(header);
       break;
     case CONTAINER_TAG_FROZEN:
+#if USE_FROZEN_RC_BUFFER
+      if (memoryState != nullptr && memoryState->frozenRCBuffer.cancelDecrement(header))
+        break;
+#endif
       IncrementRC<true>(header);
       break;
     default:
@@ -756,6 +1968,15 @@ inline void Release(ContainerHeader* header, bool useCycleCollector) {
       DecrementRC<false>(header, useCycleCollector);
       break;
     case CONTAINER_TAG_FROZEN:
+#if USE_FROZEN_RC_BUFFER
+      if (memoryState != nullptr) {
+        // Zero counter means container is being freed, and this is a reference within its
+        // component, which was never counted.
+        if (header->refCount() != 0)
+          memoryState->frozenRCBuffer.addDecrement(header);
+        break;
+      }
+#endif
       DecrementRC<true>(header, useCycleCollector);
       break;
     default:
@@ -764,46 +1985,75 @@ inline void Release(ContainerHeader* header, bool useCycleCollector) {
   }
 }
 
-// We use first slot as place to store frame-local arena container.
-// TODO: create ArenaContainer object on the stack, so that we don't
-// do two allocations per frame (ArenaContainer + actual container).
+inline ContainerChunk* allocArenaChunk(container_size_t size) {
+#if USE_ARENA_POOL
+  return memoryState->arenaPool.allocChunk(size);
+#else
+  ContainerChunk* chunk = konanConstructSizedInstance<ContainerChunk>(size);
+  chunk->size = size;
+  return chunk;
+#endif
+}
+
+inline void freeArenaChunk(ContainerChunk* chunk) {
+#if USE_ARENA_POOL
+  memoryState->arenaPool.freeChunk(chunk);
+#else
+  konanFreeMemory(chunk);
+#endif
+}
+
+// We use first slots as place to store frame-local arena container.
+// Slots are zeroed on frame enter, so arena is lazily initialized on first use.
 inline ArenaContainer* initedArena(ObjHeader** auxSlot) {
   auto frame = asFrameOverlay(auxSlot);
-  auto arena = frame->arena;
-  if (!arena) {
-    arena = konanConstructInstance<ArenaContainer>();
+  auto arena = &frame->arena;
+  if (!arena->initialized()) {
     MEMORY_LOG("Initializing arena in %p\n", frame)
+#if USE_ARENA_POOL
+    memoryState->arenaPool.arenaStarted();
+#endif
     arena->Init();
-    frame->arena = arena;
   }
   return arena;
 }
 
-inline size_t containerSize(const ContainerHeader* container) {
-  size_t result = 0;
-  const ObjHeader* obj = reinterpret_cast<const ObjHeader*>(container + 1);
-  for (int object = 0; object < container->objectCount(); object++) {
-    size_t size = objectSize(obj);
-    result += size;
-    obj = reinterpret_cast<ObjHeader*>(
-        reinterpret_cast<uintptr_t>(obj) + size);
+// Meta-objects are created and destroyed as often as weak references, so their memory
+// is recycled via the container cache of the current thread.
+inline MetaObjHeader* allocMetaObject() {
+#if USE_CONTAINER_CACHE
+  if (memoryState != nullptr)
+    return reinterpret_cast<MetaObjHeader*>(memoryState->containerCache.alloc(sizeof(MetaObjHeader), true, 0));
+#endif
+  return konanConstructInstance<MetaObjHeader>();
+}
+
+inline void freeMetaObject(MetaObjHeader* meta) {
+#if USE_CONTAINER_CACHE
+  if (memoryState != nullptr) {
+    memoryState->containerCache.free(meta, sizeof(MetaObjHeader));
+    return;
   }
-  return result;
+#endif
+  konanFreeMemory(meta);
 }
 
 }  // namespace
 
-MetaObjHeader* ObjHeader::createMetaObject(TypeInfo** location) {
-  MetaObjHeader* meta = konanConstructInstance<MetaObjHeader>();
+MetaObjHeader* ObjHeader::createMetaObject(TypeInfo** location, ObjHeader* counter) {
+  MetaObjHeader* meta = allocMetaObject();
   TypeInfo* typeInfo = *location;
   meta->typeInfo_ = typeInfo;
+  if (counter != nullptr)
+    SetRef(&meta->counter_, counter);
 #if KONAN_NO_THREADS
   *location = reinterpret_cast<TypeInfo*>(meta);
 #else
   TypeInfo* old = __sync_val_compare_and_swap(location, typeInfo, reinterpret_cast<TypeInfo*>(meta));
   if (old->typeInfo_ != old) {
     // Someone installed a new meta-object since the check.
-    konanFreeMemory(meta);
+    UpdateRef(&meta->counter_, nullptr);
+    freeMetaObject(meta);
     meta = reinterpret_cast<MetaObjHeader*>(old);
   }
 #endif
@@ -822,40 +2072,187 @@ void ObjHeader::destroyMetaObject(TypeInfo** location) {
   Kotlin_ObjCExport_releaseAssociatedObject(meta->associatedObject_);
 #endif
 
-  konanFreeMemory(meta);
+  freeMetaObject(meta);
+}
+
+namespace {
+
+inline ContainerHeader* registerContainer(MemoryState* state, ContainerHeader* result, size_t size) {
+  CONTAINER_ALLOC_EVENT(state, size, result);
+#if TRACE_MEMORY
+  state->containers->insert(result);
+#endif
+  atomicAdd(&allocCount, 1);
+#if USE_HEAP_BUDGET
+  // Keep in sync with freeContainerMemory().
+  size = alignUp(size, kObjectAlignment);
+  atomicAdd(&heapBytes, size);
+  state->allocatedBytes += size;
+#endif
+  return result;
+}
+
+#if USE_HEAP_BUDGET
+// Parses heap limit given in bytes, with optional K, M or G suffix.
+size_t parseHeapLimit(const char* value) {
+  if (value == nullptr) return 0;
+  size_t result = 0;
+  while (*value >= '0' && *value <= '9')
+    result = result * 10 + (*value++ - '0');
+  switch (*value) {
+    case 'G': case 'g':
+      result *= 1024;
+      // Fall through.
+    case 'M': case 'm':
+      result *= 1024;
+      // Fall through.
+    case 'K': case 'k':
+      result *= 1024;
+      break;
+  }
+  return result;
+}
+
+inline size_t heapBudgetCollectBytes() {
+  // Every alive state gets an even share of the soft limit, so that with many workers only those
+  // allocating the most trigger collection.
+  int states = aliveMemoryStatesCount;
+  return std::max(kHeapBudgetMinCollectBytes, heapSoftLimit / (states > 0 ? states : 1) / 4);
+}
+
+// Collects garbage of the state, unless collection is not allowed at this point.
+inline void collectOnHeapBudget(MemoryState* state) {
+#if USE_GC
+  if (state->toFree != nullptr && state->gcSuspendCount == 0 && !state->gcInProgress) {
+    MEMORY_LOG("Collecting on heap budget, heap is %zu bytes\n", heapBytes)
+    collectGarbage(state, false);
+  }
+#endif
+}
+
+// Checks allocation of `size` bytes against process-wide heap limits. Heap limits are global, but
+// state can only collect its own garbage, so once heap is over the soft limit, every state collects
+// on allocation after it allocated enough since its last collection. Returns false if the hard limit
+// would still be exceeded after collection.
+bool checkHeapBudget(MemoryState* state, size_t size) {
+  if (state->heapLimitSuspendCount > 0) return true;
+  size_t heap = heapBytes + size;
+  if (heapSoftLimit != 0 && heap > heapSoftLimit && state->allocatedBytes >= heapBudgetCollectBytes()) {
+    collectOnHeapBudget(state);
+    heap = heapBytes + size;
+  }
+  if (heapHardLimit == 0 || heap <= heapHardLimit)
+    return true;
+  collectOnHeapBudget(state);
+  return heapBytes + size <= heapHardLimit;
+}
+#endif  // USE_HEAP_BUDGET
+
+// Throws OutOfMemoryError, allowing allocation of the exception object itself.
+RUNTIME_NORETURN void throwOutOfMemory(MemoryState* state) {
+  HeapLimitSuspender suspender(state);
+  ThrowOutOfMemoryError();
+}
+
+// Container header in the memory of the new container. Inline header of single object container
+// is tagged, so that it's told apart from container pointers.
+inline ContainerHeader* containerAt(void* memory, bool inlineHeader) {
+  if (!inlineHeader) return reinterpret_cast<ContainerHeader*>(memory);
+  auto header = reinterpret_cast<ContainerHeader*>(&reinterpret_cast<ObjHeader*>(memory)->container_);
+  header->refCount_ = CONTAINER_TAG_INLINE;
+  return header;
+}
+
+inline void* allocContainerMemory(MemoryState* state, size_t size, bool clear, size_t clearPrefix) {
+#if USE_CONTAINER_CACHE
+  return state->containerCache.alloc(alignUp(size, kObjectAlignment), clear, clearPrefix);
+#else
+  return allocSystemMemory(alignUp(size, kObjectAlignment), clear, clearPrefix);
+#endif
+}
+
+#if USE_ALIGNED_ARRAYS
+// Memory is allocated with kArrayAlignment bytes to spare, and the container is placed with at least
+// a word of padding, keeping padding size right before the container.
+ContainerHeader* allocAlignedArrayContainer(MemoryState* state, size_t size, bool clear) {
+  constexpr size_t headersSize = kObjectContainerHeaderSize + sizeof(ArrayHeader);
+  uint8_t* raw = reinterpret_cast<uint8_t*>(
+      allocContainerMemory(state, size + kArrayAlignment, clear, kArrayAlignment + headersSize));
+  if (raw == nullptr) return nullptr;
+  uint8_t* memory = alignPayload(raw + sizeof(uintptr_t), headersSize);
+  reinterpret_cast<uintptr_t*>(memory)[-1] = memory - raw;
+  return registerContainer(state, containerAt(memory, USE_COMPACT_OBJECTS), size + kArrayAlignment);
+}
+#endif  // USE_ALIGNED_ARRAYS
+
+}  // namespace
+
+// If `clear` is false, only first `clearPrefix` bytes of the container are zeroed.
+// If `inlineHeader` is true, memory starts with the only object, holding the container header.
+ContainerHeader* AllocContainer(size_t size, bool clear = true, size_t clearPrefix = 0, bool inlineHeader = false) {
+  auto state = memoryState;
+  RuntimeAssert(clearPrefix >= sizeof(ContainerHeader) || clear, "Container header must be cleared");
+  void* memory = allocContainerMemory(state, size, clear, clearPrefix);
+  if (memory == nullptr) return nullptr;
+  return registerContainer(state, containerAt(memory, inlineHeader), size);
+}
+
+ContainerHeader* AllocArrayContainer(size_t size, size_t dataSize, bool clear, bool alignPayload) {
+#if USE_LARGE_ARRAYS
+  // Keep in sync with isLargeArrayContainer().
+  if (alignUp(size, kObjectAlignment) >= kLargeArrayThreshold) {
+    // Fresh mapping is zeroed anyway.
+    void* memory = allocLargeArrayContainer(dataSize);
+    if (memory == nullptr) return nullptr;
+    return registerContainer(memoryState, containerAt(memory, USE_COMPACT_OBJECTS), size);
+  }
+#endif
+#if USE_ALIGNED_ARRAYS
+  // Large arrays are page aligned anyway.
+  if (alignPayload)
+    return allocAlignedArrayContainer(memoryState, size, clear);
+#endif
+  // Elements are to be overwritten, so only clear headers.
+  return AllocContainer(size, clear, kObjectContainerHeaderSize + sizeof(ArrayHeader), USE_COMPACT_OBJECTS);
+}
+
+// Inline headers of aggregated containers are overwritten with the link to the aggregating container,
+// so are marked in the list of components, and restored once the component is freed.
+inline ContainerHeader* markAsInlined(ContainerHeader* container) {
+  return reinterpret_cast<ContainerHeader*>(reinterpret_cast<uintptr_t>(container) | 1);
 }
 
-ContainerHeader* AllocContainer(size_t size) {
-  auto state = memoryState;
-#if USE_GC
-  // TODO: try to reuse elements of finalizer queue for new allocations, question
-  // is how to get actual size of container.
-#endif
-  ContainerHeader* result = konanConstructSizedInstance<ContainerHeader>(alignUp(size, kObjectAlignment));
-  CONTAINER_ALLOC_EVENT(state, size, result);
-#if TRACE_MEMORY
-  state->containers->insert(result);
-#endif
-  atomicAdd(&allocCount, 1);
-  return result;
+inline bool isMarkedAsInlined(ContainerHeader* container) {
+  return (reinterpret_cast<uintptr_t>(container) & 1) != 0;
 }
 
+// Objects of the components are only linked to the aggregating container by
+// LinkAggregatingFrozenContainer(), as inline headers of the components get overwritten.
 ContainerHeader* AllocAggregatingFrozenContainer(KStdVector<ContainerHeader*>& containers) {
   auto componentSize = containers.size();
   auto superContainer = AllocContainer(sizeof(ContainerHeader) + sizeof(void*) * componentSize);
   auto place = reinterpret_cast<ContainerHeader**>(superContainer + 1);
   for (auto* container : containers) {
-    *place++ = container;
-    // Set link to the new container.
-    auto obj = reinterpret_cast<ObjHeader*>(container + 1);
-    obj->container_ = superContainer;
-    MEMORY_LOG("Set fictitious frozen container for %p: %p\n", obj, superContainer);
+    *place++ = container->inlined() ? markAsInlined(container) : container;
   }
   superContainer->setObjectCount(componentSize);
   superContainer->freeze();
   return superContainer;
 }
 
+void LinkAggregatingFrozenContainer(ContainerHeader* superContainer) {
+  auto place = reinterpret_cast<ContainerHeader**>(superContainer + 1);
+  for (int i = 0; i < superContainer->objectCount(); ++i) {
+    auto container = *place++;
+    auto obj = isMarkedAsInlined(container) ?
+        ContainerFirstObject(reinterpret_cast<ContainerHeader*>(reinterpret_cast<uintptr_t>(container) & ~1)) :
+        ContainerFirstObject(container);
+    // Set link to the new container.
+    obj->container_ = superContainer;
+    MEMORY_LOG("Set fictitious frozen container for %p: %p\n", obj, superContainer);
+  }
+}
+
 void FreeAggregatingFrozenContainer(ContainerHeader* container) {
   auto state = memoryState;
   RuntimeAssert(isAggregatingFrozenContainer(container), "expected fictitious frozen container");
@@ -867,8 +2264,15 @@ void FreeAggregatingFrozenContainer(ContainerHeader* container) {
   ContainerHeader** subContainer = reinterpret_cast<ContainerHeader**>(container + 1);
   MEMORY_LOG("Total subcontainers = %d\n", container->objectCount());
   for (int i = 0; i < container->objectCount(); ++i) {
-    MEMORY_LOG("Freeing subcontainer %p\n", *subContainer);
-    FreeContainer(*subContainer++);
+    auto component = *subContainer++;
+    if (isMarkedAsInlined(component)) {
+      component = reinterpret_cast<ContainerHeader*>(reinterpret_cast<uintptr_t>(component) & ~1);
+      // Frozen component, not known to GC.
+      component->refCount_ = CONTAINER_TAG_FROZEN | CONTAINER_TAG_INLINE;
+      component->setObjectCount(1);
+    }
+    MEMORY_LOG("Freeing subcontainer %p\n", component);
+    FreeContainer(component);
   }
   --state->finalizerQueueSuspendCount;
   scheduleDestroyContainer(state, container);
@@ -904,45 +2308,58 @@ void FreeContainer(ContainerHeader* container) {
 void ObjectContainer::Init(const TypeInfo* typeInfo) {
   RuntimeAssert(typeInfo->instanceSize_ >= 0, "Must be an object");
   uint32_t alloc_size =
-      sizeof(ContainerHeader) + sizeof(ObjHeader) + typeInfo->instanceSize_;
-  header_ = AllocContainer(alloc_size);
-  if (header_) {
-    // One object in this container.
-    header_->setObjectCount(1);
-     // header->refCount_ is zero initialized by AllocContainer().
-    SetHeader(GetPlace(), typeInfo);
-    MEMORY_LOG("object at %p\n", GetPlace())
-    OBJECT_ALLOC_EVENT(memoryState, type_info->instanceSize_, GetPlace())
-  }
+      kObjectContainerHeaderSize + sizeof(ObjHeader) + typeInfo->instanceSize_;
+#if USE_GC && USE_DEFERRED_RC
+  reconcileZeroCountTableOnAllocation(memoryState);
+#endif
+#if USE_HEAP_BUDGET
+  if (!checkHeapBudget(memoryState, alloc_size)) throwOutOfMemory(memoryState);
+#endif
+  header_ = AllocContainer(alloc_size, true, 0, USE_COMPACT_OBJECTS);
+  if (header_ == nullptr) throwOutOfMemory(memoryState);
+  // One object in this container.
+  header_->setObjectCount(1);
+  // header->refCount_ is initialized by AllocContainer().
+  SetHeader(GetPlace(), typeInfo);
+  MEMORY_LOG("object at %p\n", GetPlace())
+  OBJECT_ALLOC_EVENT(memoryState, typeInfo->instanceSize_, GetPlace())
 }
 
-void ArrayContainer::Init(const TypeInfo* typeInfo, uint32_t elements) {
+void ArrayContainer::Init(const TypeInfo* typeInfo, uint32_t elements, bool clear) {
   RuntimeAssert(typeInfo->instanceSize_ < 0, "Must be an array");
-  uint32_t alloc_size =
-      sizeof(ContainerHeader) + sizeof(ArrayHeader) -
-      typeInfo->instanceSize_ * elements;
-  header_ = AllocContainer(alloc_size);
-  RuntimeAssert(header_ != nullptr, "Cannot alloc memory");
-  if (header_) {
-    // One object in this container.
-    header_->setObjectCount(1);
-    // header->refCount_ is zero initialized by AllocContainer().
-    GetPlace()->count_ = elements;
-    SetHeader(GetPlace()->obj(), typeInfo);
-    MEMORY_LOG("array at %p\n", GetPlace())
-    OBJECT_ALLOC_EVENT(
-        memoryState, -typeInfo->instanceSize_ * elements, GetPlace()->obj())
-  }
-}
-
-// TODO: store arena containers in some reuseable data structure, similar to
-// finalizer queue.
+  RuntimeAssert(clear || typeInfo != theArrayTypeInfo, "Object arrays must be cleared");
+  uint32_t data_size = -typeInfo->instanceSize_ * elements;
+  uint32_t alloc_size = kObjectContainerHeaderSize + sizeof(ArrayHeader) + data_size;
+#if USE_GC && USE_DEFERRED_RC
+  reconcileZeroCountTableOnAllocation(memoryState);
+#endif
+#if USE_HEAP_BUDGET
+  if (!checkHeapBudget(memoryState, alloc_size)) throwOutOfMemory(memoryState);
+#endif
+#if USE_ALIGNED_ARRAYS
+  bool alignPayload = hasAlignedPayload(typeInfo, data_size);
+#else
+  bool alignPayload = false;
+#endif
+  header_ = AllocArrayContainer(alloc_size, data_size, clear, alignPayload);
+  if (header_ == nullptr) throwOutOfMemory(memoryState);
+  // One object in this container.
+  header_->setObjectCount(1);
+  // header->refCount_ is initialized by AllocContainer().
+  GetPlace()->count_ = elements;
+  SetHeader(GetPlace()->obj(), typeInfo);
+  MEMORY_LOG("array at %p\n", GetPlace())
+  OBJECT_ALLOC_EVENT(
+      memoryState, -typeInfo->instanceSize_ * elements, GetPlace()->obj())
+}
+
 void ArenaContainer::Init() {
-  allocContainer(1024);
+  allocContainer(0);
 }
 
 void ArenaContainer::Deinit() {
   MEMORY_LOG("Arena::Deinit start: %p\n", this)
+  retireChunk();
   auto chunk = currentChunk_;
   while (chunk != nullptr) {
     // FreeContainer() doesn't release memory when CONTAINER_TAG_STACK is set.
@@ -954,23 +2371,35 @@ void ArenaContainer::Deinit() {
   while (chunk != nullptr) {
     auto toRemove = chunk;
     chunk = chunk->next;
-    konanFreeMemory(toRemove);
+    freeArenaChunk(toRemove);
   }
+  currentChunk_ = nullptr;
+}
+
+void ArenaContainer::retireChunk() {
+  if (currentChunk_ != nullptr)
+    currentChunk_->used = current_ - reinterpret_cast<uint8_t*>(currentChunk_->asHeader() + 1);
 }
 
 bool ArenaContainer::allocContainer(container_size_t minSize) {
-  auto size = minSize + sizeof(ContainerHeader) + sizeof(ContainerChunk);
-  size = alignUp(size, kContainerAlignment);
-  // TODO: keep simple cache of container chunks.
-  ContainerChunk* result = konanConstructSizedInstance<ContainerChunk>(size);
+  container_size_t size = minSize + sizeof(ContainerHeader) + sizeof(ContainerChunk);
+  // Each next chunk is twice as big as the previous one, so that frames allocating
+  // a lot do not go to the allocator too often.
+  container_size_t chunkSize = currentChunk_ == nullptr ? kArenaMinChunkSize : currentChunk_->size * 2;
+  if (chunkSize > kArenaMaxChunkSize) chunkSize = kArenaMaxChunkSize;
+  while (chunkSize < size && chunkSize < kArenaMaxChunkSize) chunkSize *= 2;
+  if (chunkSize < size) chunkSize = alignUp(size, kContainerAlignment);
+  ContainerChunk* result = allocArenaChunk(chunkSize);
   RuntimeAssert(result != nullptr, "Cannot alloc memory");
   if (result == nullptr) return false;
+  retireChunk();
   result->next = currentChunk_;
   result->arena = this;
+  result->used = 0;
   result->asHeader()->refCount_ = (CONTAINER_TAG_STACK | CONTAINER_TAG_INCREMENT);
   currentChunk_ = result;
   current_ = reinterpret_cast<uint8_t*>(result->asHeader() + 1);
-  end_ = reinterpret_cast<uint8_t*>(result) + size;
+  end_ = reinterpret_cast<uint8_t*>(result) + chunkSize;
   return true;
 }
 
@@ -1008,23 +2437,38 @@ ObjHeader* ArenaContainer::PlaceObject(const TypeInfo* type_info) {
   if (!result) {
     return nullptr;
   }
-  OBJECT_ALLOC_EVENT(memoryState, type_info->instanceSize_, result)
   currentChunk_->asHeader()->incObjectCount();
   setHeader(result, type_info);
+  OBJECT_ALLOC_EVENT(memoryState, type_info->instanceSize_, result)
   return result;
 }
 
 ArrayHeader* ArenaContainer::PlaceArray(const TypeInfo* type_info, uint32_t count) {
   RuntimeAssert(type_info->instanceSize_ < 0, "must be an array");
   container_size_t size = sizeof(ArrayHeader) - type_info->instanceSize_ * count;
+#if USE_ALIGNED_ARRAYS
+  if (hasAlignedPayload(type_info, size - sizeof(ArrayHeader))) {
+    // Words skipped before and after the array are left zeroed, see skipPadding().
+    uint8_t* place = reinterpret_cast<uint8_t*>(this->place(size + kArrayAlignment - kObjectAlignment));
+    if (!place) {
+      return nullptr;
+    }
+    ArrayHeader* result = reinterpret_cast<ArrayHeader*>(alignPayload(place, sizeof(ArrayHeader)));
+    currentChunk_->asHeader()->incObjectCount();
+    setHeader(result->obj(), type_info);
+    result->count_ = count;
+    OBJECT_ALLOC_EVENT(memoryState, -type_info->instanceSize_ * count, result->obj())
+    return result;
+  }
+#endif
   ArrayHeader* result = reinterpret_cast<ArrayHeader*>(place(size));
   if (!result) {
     return nullptr;
   }
-  OBJECT_ALLOC_EVENT(memoryState, -type_info->instanceSize_ * count, result->obj())
   currentChunk_->asHeader()->incObjectCount();
   setHeader(result->obj(), type_info);
   result->count_ = count;
+  OBJECT_ALLOC_EVENT(memoryState, -type_info->instanceSize_ * count, result->obj())
   return result;
 }
 
@@ -1035,9 +2479,11 @@ inline void AddRef(const ObjHeader* object) {
 
 inline void ReleaseRef(const ObjHeader* object) {
   MEMORY_LOG("ReleaseRef on %p in %p\n", object, object->container())
-  // Use cycle collector only for objects having object fields, or if container is multiobject.
+  // Use cycle collector only for objects, which could be a part of cycle, or if container is multiobject.
   auto container = object->container();
-  Release(container, (object->type_info()->objOffsetsCount_ > 0) || (container->objectCount() > 1));
+  auto typeInfo = object->type_info();
+  Release(container,
+      (typeInfo->objOffsetsCount_ > 0 && (typeInfo->flags_ & TF_ACYCLIC) == 0) || (container->objectCount() > 1));
 }
 
 void AddRefFromAssociatedObject(const ObjHeader* object) {
@@ -1066,13 +2512,50 @@ MemoryState* InitMemory() {
   RuntimeAssert(sizeof(FrameOverlay) % sizeof(ObjHeader**) == 0, "Frame overlay should contain only pointers")
   RuntimeAssert(memoryState == nullptr, "memory state must be clear");
   memoryState = konanConstructInstance<MemoryState>();
+  memoryState->heap = konan::createHeap();
+  konan::setCurrentHeap(memoryState->heap);
   INIT_EVENT(memoryState)
+  memoryState->globalRoots = konanConstructInstance<KRefPtrList>();
+#if USE_CONTAINER_CACHE
+  memoryState->containerCache.init();
+#endif
+#if USE_ARENA_POOL
+  memoryState->arenaPool.init();
+#endif
+#if USE_FROZEN_RC_BUFFER
+  memoryState->frozenRCBuffer.init();
+#endif
+#if USE_HEAP_BUDGET
+  memoryState->allocatedBytes = 0;
+  memoryState->heapLimitSuspendCount = 0;
+  if (!heapLimitsInitialized) {
+    heapSoftLimit = parseHeapLimit(konan::getEnv("KONAN_HEAP_SOFT_LIMIT"));
+    heapHardLimit = parseHeapLimit(konan::getEnv("KONAN_HEAP_HARD_LIMIT"));
+    heapLimitsInitialized = true;
+  }
+#endif
 #if USE_GC
   memoryState->finalizerQueue = konanConstructInstance<ContainerHeaderDeque>();
   memoryState->toFree = konanConstructInstance<ContainerHeaderList>();
   memoryState->roots = konanConstructInstance<ContainerHeaderList>();
+  memoryState->traversalStack = konanConstructInstance<ContainerHeaderList>();
+  memoryState->grayLog = konanConstructInstance<ContainerColorList>();
+  memoryState->gcOversized = 0;
   memoryState->gcInProgress = false;
+#if USE_DEFERRED_RC
+  memoryState->deferredFrames = nullptr;
+  memoryState->zeroCountTable = konanConstructInstance<ContainerHeaderList>();
+  memoryState->zeroCountLimit = kZeroCountTableThreshold;
+  memoryState->zeroCountBytes = 0;
+  memoryState->deferredRefsCounted = false;
+#endif
   initThreshold(memoryState, kGcThreshold);
+#if GC_ERGONOMICS
+  memoryState->gcPolicy = selectGcPolicy();
+  memoryState->lastGcTimestamp = konan::getTimeMicros();
+  if (memoryState->gcPolicy->incremental)
+    memoryState->gcPauseBudget = memoryState->gcPolicy->targetPause;
+#endif
   memoryState->gcSuspendCount = 0;
 #endif
   atomicAdd(&aliveMemoryStatesCount, 1);
@@ -1081,14 +2564,30 @@ MemoryState* InitMemory() {
 
 void DeinitMemory(MemoryState* memoryState) {
 #if USE_GC
-  GarbageCollect();
+  // Freeing frozen objects, released by the final collection, may release more objects, so collect
+  // until nothing is pending, and only then tear down collector structures.
+  do {
+    GarbageCollect();
+  } while (memoryState->toFree->size() != 0 || memoryState->finalizerQueue->size() != 0
+#if USE_FROZEN_RC_BUFFER
+      || !memoryState->frozenRCBuffer.empty()
+#endif
+      );
   RuntimeAssert(memoryState->toFree->size() == 0, "Some memory have not been released after GC");
   konanDestructInstance(memoryState->toFree);
   konanDestructInstance(memoryState->roots);
+  konanDestructInstance(memoryState->traversalStack);
+  konanDestructInstance(memoryState->grayLog);
+#if USE_DEFERRED_RC
+  RuntimeAssert(memoryState->zeroCountTable->size() == 0, "Zero count table must be reconciled by GC");
+  konanDestructInstance(memoryState->zeroCountTable);
+#endif
 
   konanDestructInstance(memoryState->finalizerQueue);
   memoryState->finalizerQueue = nullptr;
 
+#elif USE_FROZEN_RC_BUFFER
+  memoryState->frozenRCBuffer.flush();
 #endif // USE_GC
 
   bool lastMemoryState = atomicAdd(&aliveMemoryStatesCount, -1) == 0;
@@ -1103,26 +2602,39 @@ void DeinitMemory(MemoryState* memoryState) {
     RuntimeAssert(allocCount == 0, "Memory leaks found");
 #endif
 
-  PRINT_EVENT(memoryState)
   DEINIT_EVENT(memoryState)
 
+#if USE_CONTAINER_CACHE
+  memoryState->containerCache.deinit();
+#endif
+#if USE_ARENA_POOL
+  memoryState->arenaPool.deinit();
+#endif
+
+  konanDestructInstance(memoryState->globalRoots);
+
+  void* heap = memoryState->heap;
   konanFreeMemory(memoryState);
   ::memoryState = nullptr;
+  konan::releaseHeap(heap);
 }
 
 MemoryState* SuspendMemory() {
     auto result = ::memoryState;
     ::memoryState = nullptr;
+    konan::setCurrentHeap(nullptr);
     return result;
 }
 
 void ResumeMemory(MemoryState* state) {
     RuntimeAssert(::memoryState == nullptr, "Cannot schedule on existing state");
     ::memoryState = state;
+    konan::setCurrentHeap(state->heap);
 }
 
 OBJ_GETTER(AllocInstance, const TypeInfo* type_info) {
   RuntimeAssert(type_info->instanceSize_ >= 0, "must be an object");
+  ProfileAllocation(type_info, type_info->instanceSize_ + sizeof(ObjHeader));
   if (isArenaSlot(OBJ_RESULT)) {
     auto arena = initedArena(asArenaSlot(OBJ_RESULT));
     auto result = arena->PlaceObject(type_info);
@@ -1134,6 +2646,7 @@ OBJ_GETTER(AllocInstance, const TypeInfo* type_info) {
 
 OBJ_GETTER(AllocArrayInstance, const TypeInfo* type_info, uint32_t elements) {
   RuntimeAssert(type_info->instanceSize_ < 0, "must be an array");
+  ProfileAllocation(type_info, sizeof(ArrayHeader) + static_cast<uint32_t>(-type_info->instanceSize_ * elements));
   if (isArenaSlot(OBJ_RESULT)) {
     auto arena = initedArena(asArenaSlot(OBJ_RESULT));
     auto result = arena->PlaceArray(type_info, elements)->obj();
@@ -1143,6 +2656,16 @@ OBJ_GETTER(AllocArrayInstance, const TypeInfo* type_info, uint32_t elements) {
   RETURN_OBJ(ArrayContainer(type_info, elements).GetPlace()->obj());
 }
 
+OBJ_GETTER(AllocArrayInstanceUninitialized, const TypeInfo* type_info, uint32_t elements) {
+  RuntimeAssert(type_info->instanceSize_ < 0, "must be an array");
+  if (isArenaSlot(OBJ_RESULT)) {
+    // Arena memory is always zeroed.
+    RETURN_RESULT_OF(AllocArrayInstance, type_info, elements);
+  }
+  ProfileAllocation(type_info, sizeof(ArrayHeader) + static_cast<uint32_t>(-type_info->instanceSize_ * elements));
+  RETURN_OBJ(ArrayContainer(type_info, elements, false).GetPlace()->obj());
+}
+
 OBJ_GETTER(InitInstance,
     ObjHeader** location, const TypeInfo* type_info, void (*ctor)(ObjHeader*)) {
   ObjHeader* value = *location;
@@ -1155,6 +2678,7 @@ OBJ_GETTER(InitInstance,
   ObjHeader* object = AllocInstance(type_info, OBJ_RESULT);
   MEMORY_LOG("Calling UpdateRef from InitInstance\n")
   UpdateRef(location, object);
+  RegisterGlobalRoot(location);
 #if KONAN_NO_EXCEPTIONS
   ctor(object);
   return object;
@@ -1180,6 +2704,7 @@ OBJ_GETTER(InitSharedInstance,
   }
   ObjHeader* object = AllocInstance(type_info, OBJ_RESULT);
   UpdateRef(location, object);
+  RegisterGlobalRoot(location);
 #if KONAN_NO_EXCEPTIONS
   ctor(object);
   FreezeSubgraph(object);
@@ -1207,10 +2732,22 @@ OBJ_GETTER(InitSharedInstance,
     // OK'ish, inited by someone else.
     RETURN_OBJ(value);
   }
+#if KONAN_NO_EXCEPTIONS
   ObjHeader* object = AllocInstance(type_info, OBJ_RESULT);
+#else
+  ObjHeader* object;
+  try {
+    object = AllocInstance(type_info, OBJ_RESULT);
+  } catch (...) {
+    // Allocation may fail on heap limit, let the next caller try again.
+    __atomic_store_n(location, nullptr, __ATOMIC_SEQ_CST);
+    throw;
+  }
+#endif
   RuntimeAssert(object->container()->normal() , "Shared object cannot be co-allocated");
   MEMORY_LOG("Calling UpdateRef from InitSharedInstance\n")
   UpdateRef(localLocation, object);
+  RegisterGlobalRoot(localLocation);
 #if KONAN_NO_EXCEPTIONS
   ctor(object);
   FreezeSubgraph(object);
@@ -1242,6 +2779,20 @@ void SetRef(ObjHeader** location, const ObjHeader* object) {
     AddRef(object);
 }
 
+bool TryAddRef(const ObjHeader* object) {
+  ContainerHeader* container = object->container();
+  if (!container->frozen()) {
+    AddRef(container);
+    return true;
+  }
+#if USE_FROZEN_RC_BUFFER
+  // Pending decrement of this thread keeps shared counter above zero.
+  if (memoryState != nullptr && memoryState->frozenRCBuffer.cancelDecrement(container))
+    return true;
+#endif
+  return container->tryIncRefCount();
+}
+
 ObjHeader** GetReturnSlotIfArena(ObjHeader** returnSlot, ObjHeader** localSlot) {
   return isArenaSlot(returnSlot) ? returnSlot : localSlot;
 }
@@ -1252,7 +2803,8 @@ ObjHeader** GetParamSlotIfArena(ObjHeader* param, ObjHeader** localSlot) {
   if ((container->refCount_ & CONTAINER_TAG_MASK) != CONTAINER_TAG_STACK)
     return localSlot;
   auto chunk = reinterpret_cast<ContainerChunk*>(container) - 1;
-  return reinterpret_cast<ObjHeader**>(reinterpret_cast<uintptr_t>(&chunk->arena) | ARENA_BIT);
+  // Arena is the first field of the frame overlay, so its address is the address of the owner frame slots.
+  return reinterpret_cast<ObjHeader**>(reinterpret_cast<uintptr_t>(chunk->arena) | ARENA_BIT);
 }
 
 void UpdateRef(ObjHeader** location, const ObjHeader* object) {
@@ -1293,6 +2845,10 @@ void UpdateReturnRef(ObjHeader** returnSlot, const ObjHeader* value) {
   UpdateRef(returnSlot, value);
 }
 
+void RegisterGlobalRoot(ObjHeader** location) {
+  memoryState->globalRoots->push_back(location);
+}
+
 void UpdateRefIfNull(ObjHeader** location, const ObjHeader* object) {
   if (object != nullptr) {
 #if KONAN_NO_THREADS
@@ -1319,15 +2875,75 @@ void EnterFrame(ObjHeader** start, int parameters, int count) {
 void LeaveFrame(ObjHeader** start, int parameters, int count) {
   MEMORY_LOG("LeaveFrame %p .. %p\n", start, start + count + parameters)
   ReleaseRefs(start + parameters + kFrameOverlaySlots, count - kFrameOverlaySlots - parameters);
-  if (*start != nullptr) {
-    auto arena = initedArena(start);
+  auto arena = &asFrameOverlay(start)->arena;
+  if (arena->initialized()) {
     MEMORY_LOG("LeaveFrame: free arena %p\n", arena)
     arena->Deinit();
-    konanFreeMemory(arena);
+#if USE_ARENA_POOL
+    memoryState->arenaPool.arenaFinished();
+#endif
     MEMORY_LOG("LeaveFrame: free arena done %p\n", arena)
   }
 }
 
+void UpdateStackRef(ObjHeader** location, const ObjHeader* object) {
+#if USE_DEFERRED_RC
+  ObjHeader* old = *location;
+  UPDATE_REF_EVENT(memoryState, old, object, location)
+  if (old != object) {
+    // Only references to frozen objects are counted, as those could be released by other threads.
+    if (object != nullptr && object->container()->frozen()) {
+      AddRef(object);
+    }
+    *const_cast<const ObjHeader**>(location) = object;
+    if (old != nullptr && old->container()->frozen()) {
+      ReleaseRef(old);
+    }
+  }
+#else
+  UpdateRef(location, object);
+#endif
+}
+
+void EnterDeferredFrame(ObjHeader** start, int count) {
+  MEMORY_LOG("EnterDeferredFrame %p .. %p\n", start, start + count)
+#if USE_DEFERRED_RC
+  auto state = memoryState;
+  start[kDeferredFrameLinkSlot] = reinterpret_cast<ObjHeader*>(state->deferredFrames);
+  start[kDeferredFrameCountSlot] = reinterpret_cast<ObjHeader*>(static_cast<uintptr_t>(count));
+  state->deferredFrames = start;
+#endif
+}
+
+void LeaveDeferredFrame(ObjHeader** start, int count) {
+  MEMORY_LOG("LeaveDeferredFrame %p .. %p\n", start, start + count)
+#if USE_DEFERRED_RC
+  auto state = memoryState;
+  RuntimeAssert(state->deferredFrames == start, "Deferred frames must be left in order");
+  state->deferredFrames = reinterpret_cast<ObjHeader**>(start[kDeferredFrameLinkSlot]);
+  for (int index = kDeferredFrameHeaderSlots; index < count; index++) {
+    ObjHeader* object = start[index];
+    if (object != nullptr && object->container()->frozen()) {
+      ReleaseRef(object);
+    }
+  }
+  // Reconcile once outermost frame is left, or if too many containers are pending.
+  auto& table = *state->zeroCountTable;
+  if (!table.empty() && !state->deferredRefsCounted &&
+      (state->deferredFrames == nullptr || table.size() >= state->zeroCountLimit ||
+       state->zeroCountBytes >= kZeroCountTableMaxBytes)) {
+    reconcileZeroCountTable(state);
+  }
+#if USE_FROZEN_RC_BUFFER
+  // Thread may not come back to Kotlin code for long, so it must not hold frozen objects.
+  if (state->deferredFrames == nullptr)
+    state->frozenRCBuffer.flush();
+#endif
+#else
+  ReleaseRefs(start + kDeferredFrameHeaderSlots, count - kDeferredFrameHeaderSlots);
+#endif
+}
+
 void ReleaseRefs(ObjHeader** start, int count) {
   MEMORY_LOG("ReleaseRefs %p .. %p\n", start, start + count)
   ObjHeader** current = start;
@@ -1346,44 +2962,18 @@ void ReleaseRefs(ObjHeader** start, int count) {
 #if USE_GC
 
 void GarbageCollect() {
-  MemoryState* state = memoryState;
-  RuntimeAssert(!state->gcInProgress, "Recursive GC is disallowed");
-
-  MEMORY_LOG("Garbage collect\n")
-
-#if GC_ERGONOMICS
-  auto gcStartTime = konan::getTimeMicros();
-#endif
-
-  state->gcInProgress = true;
-
-  processFinalizerQueue(state);
-
-  while (state->toFree->size() > 0) {
-    CollectCycles(state);
-    processFinalizerQueue(state);
-  }
+  collectGarbage(memoryState, false);
+}
 
-  state->gcInProgress = false;
+#endif // USE_GC
 
-#if GC_ERGONOMICS
-  auto gcEndTime = konan::getTimeMicros();
-  auto gcToComputeRatio = double(gcEndTime - gcStartTime) / (gcStartTime - state->lastGcTimestamp + 1);
-  if (gcToComputeRatio > kGcToComputeRatioThreshold) {
-     auto newThreshold = state->gcThreshold * 3 / 2 + 1;
-     if (newThreshold < kMaxErgonomicThreshold) {
-        MEMORY_LOG("Adjusting GC threshold to %d\n", newThreshold);
-        initThreshold(state, newThreshold);
-     }
-  }
-  MEMORY_LOG("Garbage collect: GC length=%lld sinceLast=%lld\n",
-             (gcEndTime - gcStartTime), gcStartTime - state->lastGcTimestamp);
-  state->lastGcTimestamp = gcEndTime;
+void FlushFrozenReleases() {
+#if USE_FROZEN_RC_BUFFER
+  if (memoryState != nullptr)
+    memoryState->frozenRCBuffer.flush();
 #endif
 }
 
-#endif // USE_GC
-
 void Kotlin_konan_internal_GC_collect(KRef) {
 #if USE_GC
   GarbageCollect();
@@ -1401,9 +2991,8 @@ void Kotlin_konan_internal_GC_resume(KRef) {
   MemoryState* state = memoryState;
   if (state->gcSuspendCount > 0) {
     state->gcSuspendCount--;
-    if (state->toFree != nullptr &&
-        freeableSize(state) >= state->gcThreshold) {
-      GarbageCollect();
+    if (state->toFree != nullptr && needsCollection(state)) {
+      GarbageCollectOnThreshold(state);
     }
   }
 #endif
@@ -1446,6 +3035,122 @@ KInt Kotlin_konan_internal_GC_getThreshold(KRef) {
 #endif
 }
 
+void Kotlin_konan_internal_GC_setPauseBudget(KRef, KInt value) {
+#if USE_GC
+  if (value >= 0) {
+    memoryState->gcPauseBudget = value;
+  }
+#endif
+}
+
+KInt Kotlin_konan_internal_GC_getPauseBudget(KRef) {
+#if USE_GC
+  return memoryState->gcPauseBudget;
+#else
+  return -1;
+#endif
+}
+
+KLong Kotlin_konan_internal_GC_getHeapBytes(KRef) {
+#if USE_HEAP_BUDGET
+  return heapBytes;
+#else
+  return -1;
+#endif
+}
+
+void Kotlin_konan_internal_GC_setHeapSoftLimit(KRef, KLong value) {
+#if USE_HEAP_BUDGET
+  if (value >= 0) {
+    heapSoftLimit = value;
+  }
+#endif
+}
+
+KLong Kotlin_konan_internal_GC_getHeapSoftLimit(KRef) {
+#if USE_HEAP_BUDGET
+  return heapSoftLimit;
+#else
+  return -1;
+#endif
+}
+
+void Kotlin_konan_internal_GC_setHeapHardLimit(KRef, KLong value) {
+#if USE_HEAP_BUDGET
+  if (value >= 0) {
+    heapHardLimit = value;
+  }
+#endif
+}
+
+KLong Kotlin_konan_internal_GC_getHeapHardLimit(KRef) {
+#if USE_HEAP_BUDGET
+  return heapHardLimit;
+#else
+  return -1;
+#endif
+}
+
+// Fields of GC event, as laid out in the array returned by getCollectionEvents().
+constexpr int kGcEventFields = 7;
+
+OBJ_GETTER(Kotlin_konan_internal_GC_getCollectionEvents, KRef) {
+#if USE_GC && GC_EVENT_LOG
+  const GcEventLog& log = memoryState->gcEventLog;
+  ArrayHeader* result = AllocArrayInstance(theLongArrayTypeInfo, log.size() * kGcEventFields, OBJ_RESULT)->array();
+  KLong* fields = PrimitiveArrayAddressOfElementAt<KLong>(result, 0);
+  for (int index = 0; index < log.size(); index++) {
+    const GcEvent& event = log.at(index);
+    *fields++ = event.startTime;
+    *fields++ = event.duration;
+    *fields++ = event.toFreeSize;
+    *fields++ = event.rootsSize;
+    *fields++ = event.freedContainers;
+    *fields++ = event.threshold;
+    *fields++ = event.incremental;
+  }
+  RETURN_OBJ(result->obj());
+#else
+  RETURN_RESULT_OF(AllocArrayInstance, theLongArrayTypeInfo, 0);
+#endif
+}
+
+KBoolean Kotlin_konan_internal_GC_getCollectStatistics(KRef) {
+#if COLLECT_STATISTIC
+  return memoryState->statistic.enabled;
+#else
+  return false;
+#endif
+}
+
+void Kotlin_konan_internal_GC_setCollectStatistics(KRef, KBoolean value) {
+#if COLLECT_STATISTIC
+  memoryState->statistic.setEnabled(value);
+#endif
+}
+
+void Kotlin_konan_internal_GC_resetStatistics(KRef) {
+#if COLLECT_STATISTIC
+  memoryState->statistic.reset();
+#endif
+}
+
+KBoolean Kotlin_konan_internal_GC_dumpHeap(KRef, KString path) {
+  KStdString utf8Path;
+  appendUtf8(utf8Path, path);
+  return dumpHeap(utf8Path.c_str());
+}
+
+OBJ_GETTER(Kotlin_konan_internal_GC_statistics, KRef) {
+  KStdString json;
+#if COLLECT_STATISTIC
+  memoryState->statistic.toJson(json);
+#else
+  json = "{\"enabled\":false}";
+#endif
+  RETURN_RESULT_OF(CreateStringFromUtf8, json.data(), json.size());
+}
+
 KNativePtr CreateStablePointer(KRef any) {
   if (any == nullptr) return nullptr;
   AddRef(any->container());
@@ -1476,15 +3181,27 @@ OBJ_GETTER(AdoptStablePointer, KNativePtr pointer) {
 
 #if USE_GC
 
-bool hasExternalRefs(ContainerHeader* container, ContainerHeaderSet* visited) {
-  visited->insert(container);
-  bool result = container->refCount() != 0;
-  traverseContainerReferredObjects(container, [&result, visited](ObjHeader* ref) {
-    auto child = ref->container();
-    if (!child->permanentOrFrozen() && (visited->find(child) == visited->end())) {
-      result |= hasExternalRefs(child, visited);
-    }
-  });
+// Collects containers of the subgraph into `visited`, marking them as seen. `buffered` gets number of
+// cycle candidates among them. Returns if any of the containers has non-zero reference counter.
+bool hasExternalRefs(ContainerHeaderList& stack, ContainerHeader* root, ContainerHeaderList& visited,
+                     size_t* buffered) {
+  size_t base = stack.size();
+  bool result = false;
+  root->setSeen();
+  stack.push_back(root);
+  while (stack.size() > base) {
+    auto container = popContainer(stack);
+    visited.push_back(container);
+    result |= container->refCount() != 0;
+    if (container->buffered()) (*buffered)++;
+    traverseContainerReferredObjects(container, [&stack](ObjHeader* ref) {
+      auto child = ref->container();
+      if (!child->permanentOrFrozen() && !child->seen()) {
+        child->setSeen();
+        stack.push_back(child);
+      }
+    });
+  }
   return result;
 }
 #endif
@@ -1493,174 +3210,230 @@ bool ClearSubgraphReferences(ObjHeader* root, bool checked) {
 #if USE_GC
   if (root != nullptr) {
     auto state = memoryState;
+    // Subgraph check temporarily changes reference counters.
+    HeapLimitSuspender suspender(state);
     auto container = root->container();
 
-    if (container->frozen())
+    if (container->permanentOrFrozen())
       // We assume, that frozen objects can be safely passed and are already removed
       // GC candidate list.
       return true;
 
-    ContainerHeaderSet visited;
+    auto& stack = *state->traversalStack;
+    ContainerHeaderList visited;
+    size_t buffered = 0;
     if (!checked) {
-      hasExternalRefs(container, &visited);
+      hasExternalRefs(stack, container, visited, &buffered);
     } else {
-      if (!container->permanentOrFrozen()) {
-        container->decRefCount<false>();
-        MarkGray<false>(container);
-        auto bad = hasExternalRefs(container, &visited);
-        ScanBlack<false>(container);
-        container->incRefCount<false>();
-        if (bad) return false;
+#if USE_DEFERRED_RC
+      // References from deferred slots are external as well.
+      beginCountingDeferredRefs(state);
+#endif
+      container->decRefCount<false>();
+      MarkGray<false>(stack, container);
+      auto bad = hasExternalRefs(stack, container, visited, &buffered);
+      ScanBlack<false>(stack, container);
+      container->incRefCount<false>();
+#if USE_DEFERRED_RC
+      endCountingDeferredRefs(state);
+#endif
+      if (bad) {
+        for (auto visitedContainer : visited)
+          visitedContainer->resetSeen();
+        return false;
       }
     }
 
-    // TODO: not very effecient traversal.
-    for (auto it = state->toFree->begin(); it != state->toFree->end(); ++it) {
-      auto container = *it;
-      if (visited.find(container) != visited.end()) {
-        container->resetBuffered();
-        container->setColor(CONTAINER_TAG_GC_BLACK);
-        *it = markAsRemoved(container);
+#if USE_DEFERRED_RC
+    purgeZeroCountTable(state, [](ContainerHeader* candidate) { return candidate->seen(); });
+#endif
+
+    // Subgraph is going to be owned by another thread, so its candidates cannot stay in toFree.
+    // They are recognized by seen bit, and looked up newest first, until all are found.
+    for (auto it = state->toFree->rbegin(); buffered > 0 && it != state->toFree->rend(); ++it) {
+      auto candidate = *it;
+      if (!isMarkedAsRemoved(candidate) && candidate->seen()) {
+        candidate->resetBuffered();
+        candidate->setColor(CONTAINER_TAG_GC_BLACK);
+        *it = markAsRemoved(candidate);
+        buffered--;
       }
     }
+    for (auto visitedContainer : visited)
+      visitedContainer->resetSeen();
   }
 #endif  // USE_GC
   return true;
 }
 
 /**
-  * Do DFS cycle detection with three colors:
-  *  - 'marked' bit as BLACK marker (object and its descendants processed)
-  *  - 'seen' bit as GRAY marker (object is being processed)
-  *  - not 'marked' and not 'seen' as WHITE marker (object is unprocessed)
-  * When we see GREY during DFS, it means we see cycle.
-  */
-void depthFirstTraversal(ContainerHeader* container, bool* hasCycles,
-                         KRef* firstBlocker, KStdVector<ContainerHeader*>& order) {
-  // Mark GRAY.
-  container->setSeen();
-
-  traverseContainerReferredObjects(container, [hasCycles, firstBlocker, &order](ObjHeader* obj) {
-      if (*firstBlocker != nullptr)
-        return;
-      if (obj->has_meta_object() && ((obj->meta_object()->flags_ & MF_NEVER_FROZEN) != 0)) {
-          *firstBlocker = obj;
-          return;
-      }
-      ContainerHeader* objContainer = obj->container();
-      if (!objContainer->permanentOrFrozen()) {
-        // Marked GREY, there's cycle.
-        if (objContainer->seen()) *hasCycles = true;
-
-        // Go deeper if WHITE.
-        if (!objContainer->seen() && !objContainer->marked()) {
-          depthFirstTraversal(objContainer, hasCycles, firstBlocker, order);
+ * Iterative Tarjan's search of strongly connected components of the subgraph being frozen.
+ * Visited containers are numbered in the order of discovery, and while search runs, reference
+ * counter field of the container keeps its number (tag bits are intact), with original counter
+ * saved aside. Visited containers are marked, containers on Tarjan's stack also have seen bit set.
+ * Children of containers on the DFS path are kept in the shared work stack.
+ * Components are found in reversed topological order, and are only frozen once the whole
+ * subgraph is known to be freezable.
+ */
+class SubgraphFreezer {
+ public:
+  explicit SubgraphFreezer(ContainerHeaderList& stack) : stack_(stack), blocker_(nullptr), buffered_(0) {}
+
+  // Finds components of the subgraph. Returns object, which cannot be frozen, if any.
+  KRef findComponents(ContainerHeader* root) {
+    size_t base = stack_.size();
+    visit(root);
+    while (!frames_.empty() && blocker_ == nullptr) {
+      Frame& frame = frames_.back();
+      if (frame.nextChild < frame.endChild) {
+        auto child = stack_[frame.nextChild++];
+        uint32_t node = frame.node;
+        if (!child->marked()) {
+          visit(child);
+        } else if (child->seen()) {
+          // Child is on Tarjan's stack, so it belongs to the same component.
+          nodes_[node].internalRefs++;
+          nodes_[node].lowlink = std::min(nodes_[node].lowlink, child->refCount());
         }
+        continue;
       }
-  });
-  // Mark BLACK.
-  container->resetSeen();
-  container->mark();
-  order.push_back(container);
-}
-
-void traverseStronglyConnectedComponent(ContainerHeader* container,
-                                        KStdUnorderedMap<ContainerHeader*, KStdVector<ContainerHeader*>> const& reversedEdges,
-                                        KStdVector<ContainerHeader*>& component) {
-  component.push_back(container);
-  container->mark();
-  auto it = reversedEdges.find(container);
-  RuntimeAssert(it != reversedEdges.end(), "unknown node during condensation building");
-  for (auto* nextContainer : it->second) {
-    if (!nextContainer->marked())
-      traverseStronglyConnectedComponent(nextContainer, reversedEdges, component);
-  }
-}
-
-void freezeAcyclic(ContainerHeader* rootContainer) {
-  KStdDeque<ContainerHeader*> queue;
-  queue.push_back(rootContainer);
-  while (!queue.empty()) {
-    ContainerHeader* current = queue.front();
-    queue.pop_front();
-    current->unMark();
-    current->resetBuffered();
-    current->setColor(CONTAINER_TAG_GC_BLACK);
-    // Note, that once object is frozen, it could be concurrently accessed, so
-    // color and similar attributes shall not be used.
-    current->freeze();
-    traverseContainerReferredObjects(current, [current, &queue](ObjHeader* obj) {
-        ContainerHeader* objContainer = obj->container();
-        if (!objContainer->permanentOrFrozen()) {
-          if (objContainer->marked())
-            queue.push_back(objContainer);
+      uint32_t node = frame.node;
+      stack_.resize(frame.firstChild);
+      frames_.pop_back();
+      if (nodes_[node].lowlink == node) {
+        completeComponent(node);
+      } else {
+        // Not a root of component, so parent's reference to the node is internal to the component.
+        Node& parent = nodes_[frames_.back().node];
+        parent.internalRefs++;
+        parent.lowlink = std::min(parent.lowlink, nodes_[node].lowlink);
+      }
+    }
+    stack_.resize(base);
+    if (blocker_ != nullptr) {
+      for (auto& node : nodes_) {
+        node.container->setRefCount(node.refCount);
+        node.container->unMark();
+        node.container->resetSeen();
+      }
+    }
+    return blocker_;
+  }
+
+  void freeze() {
+    size_t first = 0;
+    for (auto last : componentEnds_) {
+      int totalCount = 0;
+      component_.clear();
+      for (size_t index = first; index < last; index++) {
+        const Node& node = nodes_[components_[index]];
+        totalCount += static_cast<int>(node.refCount) - static_cast<int>(node.internalRefs);
+        node.container->setRefCount(node.refCount);
+        component_.push_back(node.container);
+      }
+      for (auto container : component_) {
+        container->unMark();
+        if (container->buffered()) {
+          buffered_++;
+          container->resetBuffered();
         }
-    });
+        container->setColor(CONTAINER_TAG_GC_BLACK);
+        // Note, that once object is frozen, it could be concurrently accessed, so
+        // color and similar attributes shall not be used.
+        container->freeze();
+      }
+      // Create fictitious container for the whole component.
+      if (component_.size() == 1) {
+        component_[0]->setRefCount(totalCount);
+      } else {
+        auto superContainer = AllocAggregatingFrozenContainer(component_);
+        // Don't count internal references.
+        superContainer->setRefCount(totalCount);
+        aggregates_.push_back(superContainer);
+      }
+      first = last;
+    }
   }
-}
 
-void freezeCyclic(ContainerHeader* rootContainer, const KStdVector<ContainerHeader*>& order) {
-  KStdUnorderedMap<ContainerHeader*, KStdVector<ContainerHeader*>> reversedEdges;
-  KStdDeque<ContainerHeader*> queue;
-  queue.push_back(rootContainer);
-  while (!queue.empty()) {
-    ContainerHeader* current = queue.front();
-    queue.pop_front();
-    current->unMark();
-    reversedEdges.emplace(current, KStdVector<ContainerHeader*>(0));
-    traverseContainerReferredObjects(current, [current, &queue, &reversedEdges](ObjHeader* obj) {
-          ContainerHeader* objContainer = obj->container();
-          if (!objContainer->permanentOrFrozen()) {
-            if (objContainer->marked())
-              queue.push_back(objContainer);
-            reversedEdges.emplace(objContainer, KStdVector<ContainerHeader*>(0)).first->second.push_back(current);
-          }
-      });
-    }
+  // Links objects to their aggregating containers, once the component containers are no longer used.
+  void linkAggregates() {
+    for (auto container : aggregates_) LinkAggregatingFrozenContainer(container);
+  }
 
-    KStdVector<KStdVector<ContainerHeader*>> components;
-    MEMORY_LOG("Condensation:\n");
-    // Enumerate in the topological order.
-    for (auto it = order.rbegin(); it != order.rend(); ++it) {
-      auto* container = *it;
-      if (container->marked()) continue;
-      KStdVector<ContainerHeader*> component;
-      traverseStronglyConnectedComponent(container, reversedEdges, component);
-      MEMORY_LOG("SCC:\n");
-  #if TRACE_MEMORY
-      for (auto c : component)
-        konan::consolePrintf("    %p\n", c);
-  #endif
-      components.push_back(std::move(component));
-    }
+  // Accounts external reference to a container of the subgraph.
+  void addReference(ContainerHeader* container) {
+    nodes_[container->refCount()].refCount++;
+  }
 
-    // Enumerate strongly connected components in reversed topological order.
-  for (auto it = components.rbegin(); it != components.rend(); ++it) {
-    auto& component = *it;
-    int internalRefsCount = 0;
-    int totalCount = 0;
-    for (auto* container : component) {
-      totalCount += container->refCount();
-      traverseContainerReferredObjects(container, [&internalRefsCount](ObjHeader* obj) {
-          if (!obj->container()->permanentOrFrozen())
-              ++internalRefsCount;
-        });
-      }
-    // Create fictitious container for the whole component.
-    auto superContainer = component.size() == 1 ? component[0] : AllocAggregatingFrozenContainer(component);
-    // Don't count internal references.
-    superContainer->setRefCount(totalCount - internalRefsCount);
+  size_t frozenContainers() const { return nodes_.size(); }
 
-    // Freeze component.
-    for (auto* container : component) {
-      container->resetBuffered();
-      container->setColor(CONTAINER_TAG_GC_BLACK);
-      // Note, that once object is frozen, it could be concurrently accessed, so
-      // color and similar attributes shall not be used.
-      container->freeze();
-    }
-  }
-}
+  // Number of frozen containers, which were cycle candidates.
+  size_t bufferedContainers() const { return buffered_; }
+
+ private:
+  struct Node {
+    ContainerHeader* container;
+    uint32_t refCount;
+    uint32_t lowlink;
+    // References from the container to other containers of its component.
+    uint32_t internalRefs;
+  };
+
+  struct Frame {
+    uint32_t node;
+    // Children not yet processed are [nextChild, endChild) in the work stack.
+    size_t firstChild;
+    size_t nextChild;
+    size_t endChild;
+  };
+
+  void visit(ContainerHeader* container) {
+    uint32_t node = nodes_.size();
+    Node entry = { container, container->refCount(), node, 0 };
+    nodes_.push_back(entry);
+    container->setRefCount(node);
+    container->mark();
+    container->setSeen();
+    tarjanStack_.push_back(node);
+    size_t firstChild = stack_.size();
+    traverseContainerReferredObjects(container, [this](ObjHeader* obj) {
+      if (blocker_ != nullptr)
+        return;
+      if (obj->has_meta_object() && ((obj->meta_object()->flags_ & MF_NEVER_FROZEN) != 0)) {
+        blocker_ = obj;
+        return;
+      }
+      ContainerHeader* objContainer = obj->container();
+      if (!objContainer->permanentOrFrozen())
+        stack_.push_back(objContainer);
+    });
+    Frame frame = { node, firstChild, firstChild, stack_.size() };
+    frames_.push_back(frame);
+  }
+
+  void completeComponent(uint32_t root) {
+    uint32_t node;
+    do {
+      node = tarjanStack_.back();
+      tarjanStack_.pop_back();
+      nodes_[node].container->resetSeen();
+      components_.push_back(node);
+    } while (node != root);
+    componentEnds_.push_back(components_.size());
+  }
+
+  ContainerHeaderList& stack_;
+  KRef blocker_;
+  size_t buffered_;
+  KStdVector<Node> nodes_;
+  KStdVector<Frame> frames_;
+  KStdVector<uint32_t> tarjanStack_;
+  // Nodes of all components, in order components were found.
+  KStdVector<uint32_t> components_;
+  KStdVector<size_t> componentEnds_;
+  KStdVector<ContainerHeader*> component_;
+  KStdVector<ContainerHeader*> aggregates_;
+};
 
 /**
  * Theory of operations.
@@ -1674,7 +3447,7 @@ void freezeCyclic(ContainerHeader* rootContainer, const KStdVector<ContainerHead
  * it could be correctly released by just atomic decrement on reference counter, without additional
  * cycle collector run.
  * So during subgraph freezing operation, we perform the following steps:
- *   - run Kosoraju-Sharir algorithm to find strongly connected components
+ *   - run Tarjan's algorithm to find strongly connected components
  *   - put all objects in each strongly connected component into an artificial container
  *     (we assume that they all were in single element containers initially), single-object
  *     components remain in the same container
@@ -1686,34 +3459,40 @@ void freezeCyclic(ContainerHeader* rootContainer, const KStdVector<ContainerHead
  * references could be passed across multiple threads.
  */
 void FreezeSubgraph(ObjHeader* root) {
-  // First check that passed object graph has no cycles.
-  // If there are cycles - run graph condensation on cyclic graphs using Kosoraju-Sharir.
   ContainerHeader* rootContainer = root->container();
   if (rootContainer->permanentOrFrozen()) return;
 
-  // Do DFS cycle detection.
-  bool hasCycles = false;
-  KRef firstBlocker = nullptr;
-  KStdVector<ContainerHeader*> order;
-  depthFirstTraversal(rootContainer, &hasCycles, &firstBlocker, order);
+  auto state = memoryState;
+  HeapLimitSuspender suspender(state);
+  SubgraphFreezer freezer(*state->traversalStack);
+  KRef firstBlocker = freezer.findComponents(rootContainer);
   if (firstBlocker != nullptr) {
     ThrowFreezingException(root, firstBlocker);
   }
-  // Now unmark all marked objects, and freeze them, if no cycles detected.
-  if (hasCycles) {
-    freezeCyclic(rootContainer, order);
-  } else {
-    freezeAcyclic(rootContainer );
-  }
+#if USE_DEFERRED_RC
+  // References to frozen objects are counted, so ones from deferred slots shall be counted now.
+  traverseDeferredRefs(state, [&freezer](ContainerHeader* container) {
+    if (container->marked())
+      freezer.addReference(container);
+  });
+#endif
+  freezer.freeze();
+  FREEZE_EVENT(state, freezer.frozenContainers())
+#if USE_DEFERRED_RC
+  purgeZeroCountTable(state, [](ContainerHeader* container) { return container->frozen(); });
+#endif
 
-  // Now remove frozen objects from the toFree list.
-  // TODO: optimize it by keeping ignored (i.e. freshly frozen) objects in the set,
-  // and use it when analyzing toFree during collection.
-  auto state = memoryState;
-  for (auto& container : *(state->toFree)) {
-      if (!isMarkedAsRemoved(container) && container->frozen())
-        container = markAsRemoved(container);
+  // Now remove frozen objects from the toFree list, they are looked up newest first,
+  // until all are found.
+  size_t buffered = freezer.bufferedContainers();
+  for (auto it = state->toFree->rbegin(); buffered > 0 && it != state->toFree->rend(); ++it) {
+    auto container = *it;
+    if (!isMarkedAsRemoved(container) && container->frozen()) {
+      *it = markAsRemoved(container);
+      buffered--;
+    }
   }
+  freezer.linkAggregates();
 }
 
 // This function is called from field mutators to check if object's header is frozen.
@@ -1723,32 +3502,46 @@ void MutationCheck(ObjHeader* obj) {
 }
 
 OBJ_GETTER(SwapRefLocked,
-    ObjHeader** location, ObjHeader* expectedValue, ObjHeader* newValue, int32_t* spinlock) {
-  lock(spinlock);
+    ObjHeader** location, ObjHeader* expectedValue, ObjHeader* newValue, int32_t* spinlock, int32_t* readers) {
+  AdaptiveLock(spinlock);
   ObjHeader* oldValue = *location;
   // We do not use UpdateRef() here to avoid having ReleaseRef() on return slot under the lock.
   if (oldValue == expectedValue) {
-    SetRef(location, newValue);
+    if (newValue != nullptr)
+      AddRef(newValue);
+#if KONAN_NO_THREADS
+    *location = newValue;
+#else
+    __atomic_store_n(location, newValue, __ATOMIC_SEQ_CST);
+    // Lock-free readers may still be adding reference to the old value, soon released by the caller.
+    AwaitReaders(readers);
+#endif
   } else {
     // We create an additional reference to the [oldValue] in the return slot.
     if (oldValue != nullptr && isRefCounted(oldValue)) {
       AddRef(oldValue);
     }
   }
-  unlock(spinlock);
+  AdaptiveUnlock(spinlock);
   // [oldValue] ownership was either transferred from *location to return slot if CAS succeeded, or
   // we explicitly added a new reference if CAS failed.
   updateReturnRefAdded(OBJ_RESULT, oldValue);
   return oldValue;
 }
 
-OBJ_GETTER(ReadRefLocked, ObjHeader** location, int32_t* spinlock) {
-  lock(spinlock);
+OBJ_GETTER(ReadRefLockFree, ObjHeader** location, int32_t* readers) {
+#if KONAN_NO_THREADS
   ObjHeader* value = *location;
-  // We do not use UpdateRef() here to avoid having ReleaseRef() on return slot under the lock.
   if (value != nullptr)
     AddRef(value);
-  unlock(spinlock);
+#else
+  uint32_t epoch = EnterReaders(readers);
+  ObjHeader* value = __atomic_load_n(location, __ATOMIC_SEQ_CST);
+  // Value cannot be freed until we leave, see AwaitReaders().
+  if (value != nullptr)
+    AddRef(value);
+  LeaveReaders(readers, epoch);
+#endif
   updateReturnRefAdded(OBJ_RESULT, value);
   return value;
 }
@@ -17,10 +17,28 @@
 #ifndef RUNTIME_MEMORY_H
 #define RUNTIME_MEMORY_H
 
+#include <stddef.h>
+
 #include "Assert.h"
 #include "Common.h"
 #include "TypeInfo.h"
 
+// Single object heap containers keep their header inline, in place of the container pointer
+// of the object, see ObjHeader::container(). Requires the header to fit into the pointer, with
+// CONTAINER_TAG_INLINE bit in the lowest byte of it.
+#if __SIZEOF_POINTER__ == 8 && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define USE_COMPACT_OBJECTS 1
+#else
+#define USE_COMPACT_OBJECTS 0
+#endif
+
+// Payloads of primitive arrays at least that many bytes long are aligned to that many bytes, when
+// allocated in the heap or in an arena. Could be set to 16, 32 or 64 when building the runtime,
+// default of 8 is the alignment of all objects.
+#ifndef KONAN_ARRAY_ALIGNMENT
+#define KONAN_ARRAY_ALIGNMENT 8
+#endif
+
 typedef enum {
   // Those bit masks are applied to refCount_ field.
   // Container is normal thread local container.
@@ -33,12 +51,15 @@ typedef enum {
   CONTAINER_TAG_PERMANENT = 2,
   // Stack container, no need to free, children cleanup still shall be there.
   CONTAINER_TAG_STACK = 3,
+  // Mask for container type.
+  CONTAINER_TAG_MASK = (1 << 2) - 1,
+  // Container header is inline, in place of the container pointer of its only object.
+  // Never set in container pointers, as containers are aligned.
+  CONTAINER_TAG_INLINE = 1 << 2,
   // Shift to get actual counter.
-  CONTAINER_TAG_SHIFT = 2,
+  CONTAINER_TAG_SHIFT = 3,
   // Actual value to increment/decrement container by. Tag is in lower bits.
   CONTAINER_TAG_INCREMENT = 1 << CONTAINER_TAG_SHIFT,
-  // Mask for container type.
-  CONTAINER_TAG_MASK = CONTAINER_TAG_INCREMENT - 1,
 
   // Those bit masks are applied to objectCount_ field.
   // Shift to get actual object count.
@@ -91,12 +112,16 @@ struct ContainerHeader {
     return (refCount_ & CONTAINER_TAG_MASK) == CONTAINER_TAG_STACK;
   }
 
+  inline bool inlined() const {
+    return (refCount_ & CONTAINER_TAG_INLINE) != 0;
+  }
+
   inline unsigned refCount() const {
     return refCount_ >> CONTAINER_TAG_SHIFT;
   }
 
   inline void setRefCount(unsigned refCount) {
-    refCount_ = tag() | (refCount << CONTAINER_TAG_SHIFT);
+    refCount_ = (refCount_ & (CONTAINER_TAG_INCREMENT - 1)) | (refCount << CONTAINER_TAG_SHIFT);
   }
 
   template <bool Atomic>
@@ -111,13 +136,28 @@ struct ContainerHeader {
 #endif
   }
 
+  // Increments counter, unless it is already zero, so that container being freed is never resurrected.
+  inline bool tryIncRefCount() {
+#ifdef KONAN_NO_THREADS
+    if (refCount() == 0) return false;
+    refCount_ += CONTAINER_TAG_INCREMENT;
+    return true;
+#else
+    while (true) {
+      uint32_t old = refCount_;
+      if ((old >> CONTAINER_TAG_SHIFT) == 0) return false;
+      if (__sync_bool_compare_and_swap(&refCount_, old, old + CONTAINER_TAG_INCREMENT)) return true;
+    }
+#endif
+  }
+
   template <bool Atomic>
-  inline int decRefCount() {
+  inline int decRefCount(unsigned count = 1) {
 #ifdef KONAN_NO_THREADS
-    int value = refCount_ -= CONTAINER_TAG_INCREMENT;
+    int value = refCount_ -= count * CONTAINER_TAG_INCREMENT;
 #else
     int value = Atomic ?
-       __sync_sub_and_fetch(&refCount_, CONTAINER_TAG_INCREMENT) : refCount_ -= CONTAINER_TAG_INCREMENT;
+       __sync_sub_and_fetch(&refCount_, count * CONTAINER_TAG_INCREMENT) : refCount_ -= count * CONTAINER_TAG_INCREMENT;
 #endif
     return value >> CONTAINER_TAG_SHIFT;
   }
@@ -205,6 +245,10 @@ struct ObjHeader {
   }
 
   ContainerHeader* container() const {
+#if USE_COMPACT_OBJECTS
+    auto header = reinterpret_cast<ContainerHeader*>(const_cast<ContainerHeader**>(&container_));
+    if (header->inlined()) return header;
+#endif
     return container_;
   }
 
@@ -216,7 +260,9 @@ struct ObjHeader {
     return container()->permanent();
   }
 
-  static MetaObjHeader* createMetaObject(TypeInfo** location);
+  // If `counter` is not null, it is stored in the new meta-object as weak reference counter before
+  // the meta-object is published.
+  static MetaObjHeader* createMetaObject(TypeInfo** location, ObjHeader* counter = nullptr);
   static void destroyMetaObject(TypeInfo** location);
 };
 
@@ -230,7 +276,7 @@ struct ArrayHeader {
   }
 
   ContainerHeader* container() const {
-    return container_;
+    return obj()->container();
   }
 
   ObjHeader* obj() { return reinterpret_cast<ObjHeader*>(this); }
@@ -254,6 +300,17 @@ struct MetaObjHeader {
 #endif
 };
 
+// First object in the container.
+inline ObjHeader* ContainerFirstObject(ContainerHeader* container) {
+  if (container->inlined())
+    return reinterpret_cast<ObjHeader*>(reinterpret_cast<uintptr_t>(container) - offsetof(ObjHeader, container_));
+  return reinterpret_cast<ObjHeader*>(container + 1);
+}
+
+inline const ObjHeader* ContainerFirstObject(const ContainerHeader* container) {
+  return ContainerFirstObject(const_cast<ContainerHeader*>(container));
+}
+
 inline uint32_t ArrayDataSizeBytes(const ArrayHeader* obj) {
   // Instance size is negative.
   return -obj->type_info()->instanceSize_ * obj->count_;
@@ -266,7 +323,8 @@ class Container {
   ContainerHeader* header_;
 
   void SetHeader(ObjHeader* obj, const TypeInfo* type_info) {
-    obj->container_ = header_;
+    if (!header_->inlined())
+      obj->container_ = header_;
     obj->typeInfoOrMeta_ = const_cast<TypeInfo*>(type_info);
     // Take into account typeInfo's immutability for ARC strategy.
     if ((type_info->flags_ & TF_IMMUTABLE) != 0)
@@ -286,7 +344,7 @@ class ObjectContainer : public Container {
   // ::Release().
 
   ObjHeader* GetPlace() const {
-    return reinterpret_cast<ObjHeader*>(header_ + 1);
+    return ContainerFirstObject(header_);
   }
 
  private:
@@ -296,18 +354,19 @@ class ObjectContainer : public Container {
 
 class ArrayContainer : public Container {
  public:
-  ArrayContainer(const TypeInfo* type_info, uint32_t elements) {
-    Init(type_info, elements);
+  // If `clear` is false, array elements are left uninitialized.
+  ArrayContainer(const TypeInfo* type_info, uint32_t elements, bool clear = true) {
+    Init(type_info, elements, clear);
   }
 
   // Array container shalln't have any dtor, as it's being freed by ::Release().
 
   ArrayHeader* GetPlace() const {
-    return reinterpret_cast<ArrayHeader*>(header_ + 1);
+    return ContainerFirstObject(header_)->array();
   }
 
  private:
-  void Init(const TypeInfo* type_info, uint32_t elements);
+  void Init(const TypeInfo* type_info, uint32_t elements, bool clear);
 };
 
 // Class representing arena-style placement container.
@@ -319,17 +378,27 @@ class ArenaContainer;
 struct ContainerChunk {
   ContainerChunk* next;
   ArenaContainer* arena;
+  // Size of the chunk in bytes, including this header.
+  container_size_t size;
+  // Bytes handed out after the container header, only valid once the chunk is retired.
+  container_size_t used;
   // Then we have ContainerHeader here.
   ContainerHeader* asHeader() {
     return reinterpret_cast<ContainerHeader*>(this + 1);
   }
 };
 
+// Arena object itself is placed in the frame overlay slots of its owner frame, and so
+// zero-initialized memory means arena not yet in use.
 class ArenaContainer {
  public:
   void Init();
   void Deinit();
 
+  bool initialized() const {
+    return currentChunk_ != nullptr;
+  }
+
   // Place individual object in this container.
   ObjHeader* PlaceObject(const TypeInfo* type_info);
 
@@ -345,6 +414,9 @@ class ArenaContainer {
 
   bool allocContainer(container_size_t minSize);
 
+  // Remembers how much of the current chunk is used.
+  void retireChunk();
+
   void setHeader(ObjHeader* obj, const TypeInfo* typeInfo) {
     obj->container_ = currentChunk_->asHeader();
     obj->typeInfoOrMeta_ = const_cast<TypeInfo*>(typeInfo);
@@ -399,15 +471,20 @@ void ResumeMemory(MemoryState* state);
 // its owner frame.
 // Escape analysis algorithm is the provider of information for decision on exact aux slot
 // selection, and comes from upper bound esteemation of object lifetime.
+// Heap allocation throws OutOfMemoryError, if memory cannot be allocated or process-wide
+// hard heap limit is exceeded.
 //
-OBJ_GETTER(AllocInstance, const TypeInfo* type_info) RUNTIME_NOTHROW;
-OBJ_GETTER(AllocArrayInstance, const TypeInfo* type_info, uint32_t elements) RUNTIME_NOTHROW;
+OBJ_GETTER(AllocInstance, const TypeInfo* type_info);
+OBJ_GETTER(AllocArrayInstance, const TypeInfo* type_info, uint32_t elements);
+// Same as AllocArrayInstance(), but array elements may contain garbage. Only for arrays of
+// primitive types, and caller must overwrite all the elements before the array is used.
+OBJ_GETTER(AllocArrayInstanceUninitialized, const TypeInfo* type_info, uint32_t elements);
 void DeinitInstanceBody(const TypeInfo* typeInfo, void* body);
 OBJ_GETTER(InitInstance, ObjHeader** location, const TypeInfo* type_info,
            void (*ctor)(ObjHeader*));
 
 // Weak reference operations.
-// Atomically clears counter object reference.
+// Atomically clears counter object reference, and waits for readers which could still see it.
 void WeakReferenceCounterClear(ObjHeader* counter);
 
 //
@@ -430,33 +507,51 @@ void WeakReferenceCounterClear(ObjHeader* counter);
 //  - most manipulations on objects happens in SSA variables and do no affect slots
 //  - exception handlers knowns slot locations for every function, and can update references
 //    in intermediate frames when throwing
+//  - local variables live in separate deferred slots, references from which are not counted;
+//    objects, whose counter dropped to zero, are kept in zero count table until reconciliation
+//    with deferred slots of all frames at safe points
 //
 
 // Sets location.
 void SetRef(ObjHeader** location, const ObjHeader* object) RUNTIME_NOTHROW;
 // Updates location.
 void UpdateRef(ObjHeader** location, const ObjHeader* object) RUNTIME_NOTHROW;
+// Registers location of global or thread-local reference, which is a root of the heap of the current thread.
+void RegisterGlobalRoot(ObjHeader** location) RUNTIME_NOTHROW;
 // Updates location if it is null, atomically.
 void UpdateRefIfNull(ObjHeader** location, const ObjHeader* object) RUNTIME_NOTHROW;
+// Adds reference to the object, which is not owned by the caller, unless the object is frozen and
+// is already being freed. Returns false in that case.
+bool TryAddRef(const ObjHeader* object) RUNTIME_NOTHROW;
 // Updates reference in return slot.
 void UpdateReturnRef(ObjHeader** returnSlot, const ObjHeader* object) RUNTIME_NOTHROW;
-// Compares and swaps reference with taken lock.
-OBJ_GETTER(SwapRefLocked,
-    ObjHeader** location, ObjHeader* expectedValue, ObjHeader* newValue, int32_t* spinlock) RUNTIME_NOTHROW;
-// Reads reference with taken lock.
-OBJ_GETTER(ReadRefLocked, ObjHeader** location, int32_t* spinlock) RUNTIME_NOTHROW;
+// Compares and swaps reference with taken lock. Replaced value is returned once readers of the
+// location, which could have seen it, are done.
+OBJ_GETTER(SwapRefLocked, ObjHeader** location, ObjHeader* expectedValue, ObjHeader* newValue,
+    int32_t* spinlock, int32_t* readers) RUNTIME_NOTHROW;
+// Reads reference updated with SwapRefLocked() without taking the lock, registering in `readers` word instead.
+OBJ_GETTER(ReadRefLockFree, ObjHeader** location, int32_t* readers) RUNTIME_NOTHROW;
 // Optimization: release all references in range.
 void ReleaseRefs(ObjHeader** start, int count) RUNTIME_NOTHROW;
 // Called on frame enter, if it has object slots.
 void EnterFrame(ObjHeader** start, int parameters, int count) RUNTIME_NOTHROW;
 // Called on frame leave, if it has object slots.
 void LeaveFrame(ObjHeader** start, int parameters, int count) RUNTIME_NOTHROW;
+// Updates local variable slot of the frame with deferred reference counting, only references
+// to frozen objects are counted.
+void UpdateStackRef(ObjHeader** location, const ObjHeader* object) RUNTIME_NOTHROW;
+// Called on frame enter, if it has local variable slots. First two slots are reserved for runtime.
+void EnterDeferredFrame(ObjHeader** start, int count) RUNTIME_NOTHROW;
+// Called on frame leave, if it has local variable slots.
+void LeaveDeferredFrame(ObjHeader** start, int count) RUNTIME_NOTHROW;
 // Tries to use returnSlot's arena for allocation.
 ObjHeader** GetReturnSlotIfArena(ObjHeader** returnSlot, ObjHeader** localSlot) RUNTIME_NOTHROW;
 // Tries to use param's arena for allocation.
 ObjHeader** GetParamSlotIfArena(ObjHeader* param, ObjHeader** localSlot) RUNTIME_NOTHROW;
 // Collect garbage, which cannot be found by reference counting (cycles).
 void GarbageCollect() RUNTIME_NOTHROW;
+// Applies decrements of frozen objects reference counters, withheld by the current thread.
+void FlushFrozenReleases() RUNTIME_NOTHROW;
 // Clears object subgraph references from memory subsystem, and optionally
 // checks if subgraph referenced by given root is disjoint from the rest of
 // object graph, i.e. no external references exists.
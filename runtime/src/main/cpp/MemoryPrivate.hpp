@@ -22,4 +22,7 @@
 void AddRefFromAssociatedObject(const ObjHeader* object) RUNTIME_NOTHROW;
 void ReleaseRefFromAssociatedObject(const ObjHeader* object) RUNTIME_NOTHROW;
 
+// Appends fully qualified name of the type, converted to UTF-8.
+void AppendTypeName(KStdString& out, const TypeInfo* typeInfo);
+
 #endif // RUNTIME_MEMORYPRIVATE_HPP
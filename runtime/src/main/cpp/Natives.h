@@ -56,7 +56,7 @@ inline const KInt* IntArrayAddressOfElementAt(const ArrayHeader* obj, KInt index
   return reinterpret_cast<const KInt*>(obj + 1) + index;
 }
 
-// Consider aligning of base to sizeof(T).
+// Base is aligned to KONAN_ARRAY_ALIGNMENT for big enough arrays, placed in the heap or in an arena.
 template <typename T>
 inline T* PrimitiveArrayAddressOfElementAt(ArrayHeader* obj, KInt index) {
   return reinterpret_cast<T*>(obj + 1) + index;
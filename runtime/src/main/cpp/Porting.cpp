@@ -24,14 +24,26 @@
 #include <string.h>
 #if !KONAN_NO_THREADS
 #include <pthread.h>
+#include <sched.h>
+#endif
+#if !KONAN_NO_THREADS && defined(__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
 #endif
 #include <unistd.h>
+#if !KONAN_WASM && !KONAN_ZEPHYR
+#include <fcntl.h>
+#endif
+#if !KONAN_NO_MMAP
+#include <sys/mman.h>
+#endif
 #if KONAN_WINDOWS
 #include <windows.h>
 #endif
 
 #include <chrono>
 
+#include "Atomic.h"
 #include "Common.h"
 #include "Porting.h"
 
@@ -165,6 +177,24 @@ void onThreadExit(void (*destructor)()) {
 #endif  // !KONAN_NO_THREADS
 }
 
+void waitOnAddress(int32_t* address, int32_t expected) {
+#if KONAN_NO_THREADS
+  // Nobody else could change the value.
+#elif defined(__linux__)
+  syscall(SYS_futex, address, FUTEX_WAIT_PRIVATE, expected, nullptr, nullptr, 0);
+#elif KONAN_WINDOWS
+  SwitchToThread();
+#else
+  sched_yield();
+#endif
+}
+
+void wakeOnAddress(int32_t* address) {
+#if !KONAN_NO_THREADS && defined(__linux__)
+  syscall(SYS_futex, address, FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+#endif
+}
+
 // Process execution.
 void abort(void) {
   ::abort();
@@ -180,6 +210,14 @@ void exit(int32_t status) {
 }
 #endif
 
+const char* getEnv(const char* name) {
+#if KONAN_WASM || KONAN_ZEPHYR
+  return nullptr;
+#else
+  return ::getenv(name);
+#endif
+}
+
 // String/byte operations.
 // memcpy/memmove are not here intentionally, as frequently implemented/optimized
 // by C compiler.
@@ -212,22 +250,291 @@ size_t strnlen(const char* buffer, size_t maxSize) {
 // Memory operations.
 #if KONAN_INTERNAL_DLMALLOC
 extern "C" void* dlcalloc(size_t, size_t);
+extern "C" void* dlmalloc(size_t);
 extern "C" void dlfree(void*);
 #define calloc_impl dlcalloc
+#define malloc_impl dlmalloc
 #define free_impl dlfree
 #else
 #define calloc_impl ::calloc
+#define malloc_impl ::malloc
 #define free_impl ::free
 #endif
 
+// Thread heaps are built on top of dlmalloc mspaces, see dlmalloc/malloc.cpp. They are opt-in, with
+// KONAN_THREAD_HEAPS, and need the bundled allocator, as free() finds the owning heap by chunk footer.
+#if KONAN_INTERNAL_DLMALLOC && KONAN_THREAD_HEAPS && !KONAN_NO_THREADS
+#define USE_THREAD_HEAPS 1
+#else
+#define USE_THREAD_HEAPS 0
+#endif
+
+#if USE_THREAD_HEAPS
+extern "C" void* create_mspace(size_t, int);
+extern "C" size_t destroy_mspace(void*);
+extern "C" int mspace_trim(void*, size_t);
+extern "C" void* mspace_calloc(void*, size_t, size_t);
+extern "C" void* mspace_malloc(void*, size_t);
+extern "C" void mspace_free(void*, void*);
+extern "C" void mspace_set_user_data(void*, void*);
+extern "C" void* mspace_user_data_of(const void*);
+
+namespace {
+
+// Block freed by a foreign thread, linked through its first word.
+struct RemoteBlock {
+  RemoteBlock* next;
+};
+
+struct Heap {
+  // Unlocked mspace, only touched by the thread the heap is attached to.
+  void* space;
+  // Blocks freed by foreign threads, returned to the space by the owner.
+  RemoteBlock* volatile remoteFrees;
+  // Blocks allocated from the space and not yet returned to it. Like the space, only updated by
+  // the owner, or with releasedHeapsLock taken, once the heap is released.
+  size_t liveBlocks;
+  // Released heap has no owner, so foreign threads return blocks to it with releasedHeapsLock taken.
+  volatile bool released;
+  // Link in the list of released or spare heaps.
+  Heap* nextReleased;
+};
+
+THREAD_LOCAL_VARIABLE Heap* currentHeap = nullptr;
+
+// Frozen objects allocated in the heap may outlive its thread, so released heap still having blocks
+// is kept, until it gets empty or is handed over to the new thread. Heap descriptors are never
+// freed, as foreign threads may look at them after giving the last block back, and are reused.
+Heap* releasedHeaps = nullptr;
+Heap* spareHeaps = nullptr;
+pthread_mutex_t releasedHeapsLock = PTHREAD_MUTEX_INITIALIZER;
+
+void drainRemoteFrees(Heap* heap) {
+  RemoteBlock* block = heap->remoteFrees;
+  while (block != nullptr) {
+    RemoteBlock* head = compareAndSwap(&heap->remoteFrees, block, static_cast<RemoteBlock*>(nullptr));
+    if (head == block) break;
+    block = head;
+  }
+  while (block != nullptr) {
+    RemoteBlock* next = block->next;
+    mspace_free(heap->space, block);
+    heap->liveBlocks--;
+    block = next;
+  }
+}
+
+inline Heap* currentHeapForAlloc() {
+  Heap* heap = currentHeap;
+  if (heap != nullptr && heap->remoteFrees != nullptr) drainRemoteFrees(heap);
+  return heap;
+}
+
+inline void* countBlock(Heap* heap, void* block) {
+  if (block != nullptr) heap->liveBlocks++;
+  return block;
+}
+
+// Must be called with releasedHeapsLock taken.
+void destroyHeap(Heap* heap) {
+  destroy_mspace(heap->space);
+  heap->space = nullptr;
+  heap->nextReleased = spareHeaps;
+  spareHeaps = heap;
+}
+
+// Returns blocks freed by foreign threads to the released heap, and destroys it once it is empty.
+void reclaimReleasedHeap(Heap* heap) {
+  pthread_mutex_lock(&releasedHeapsLock);
+  if (heap->released) {
+    drainRemoteFrees(heap);
+    if (heap->liveBlocks == 0) {
+      Heap** link = &releasedHeaps;
+      while (*link != heap) link = &(*link)->nextReleased;
+      *link = heap->nextReleased;
+      heap->released = false;
+      destroyHeap(heap);
+    }
+  }
+  pthread_mutex_unlock(&releasedHeapsLock);
+}
+
+}  // namespace
+#endif  // USE_THREAD_HEAPS
+
 void* calloc(size_t count, size_t size) {
+#if USE_THREAD_HEAPS
+  Heap* heap = currentHeapForAlloc();
+  if (heap != nullptr) return countBlock(heap, mspace_calloc(heap->space, count, size));
+#endif
   return calloc_impl(count, size);
 }
 
+void* malloc(size_t size) {
+#if USE_THREAD_HEAPS
+  Heap* heap = currentHeapForAlloc();
+  if (heap != nullptr) return countBlock(heap, mspace_malloc(heap->space, size));
+#endif
+  return malloc_impl(size);
+}
+
 void free(void* pointer) {
+#if USE_THREAD_HEAPS
+  if (pointer == nullptr) return;
+  Heap* owner = reinterpret_cast<Heap*>(mspace_user_data_of(pointer));
+  if (owner != nullptr) {
+    if (owner == currentHeap) {
+      mspace_free(owner->space, pointer);
+      owner->liveBlocks--;
+      return;
+    }
+    RemoteBlock* block = reinterpret_cast<RemoteBlock*>(pointer);
+    RemoteBlock* head;
+    do {
+      head = owner->remoteFrees;
+      block->next = head;
+    } while (compareAndSwap(&owner->remoteFrees, head, block) != head);
+    // Heap could be released before or after the block was pushed, so check after.
+    if (__atomic_load_n(&owner->released, __ATOMIC_SEQ_CST))
+      reclaimReleasedHeap(owner);
+    return;
+  }
+#endif
   free_impl(pointer);
 }
 
+void* createHeap() {
+#if USE_THREAD_HEAPS
+  pthread_mutex_lock(&releasedHeapsLock);
+  Heap* heap = releasedHeaps;
+  if (heap != nullptr) {
+    releasedHeaps = heap->nextReleased;
+    __atomic_store_n(&heap->released, false, __ATOMIC_SEQ_CST);
+  } else {
+    heap = spareHeaps;
+    if (heap != nullptr) spareHeaps = heap->nextReleased;
+  }
+  pthread_mutex_unlock(&releasedHeapsLock);
+  if (heap != nullptr && heap->space != nullptr) {
+    heap->nextReleased = nullptr;
+    return heap;
+  }
+  if (heap == nullptr) {
+    heap = reinterpret_cast<Heap*>(calloc_impl(1, sizeof(Heap)));
+    if (heap == nullptr) return nullptr;
+  }
+  heap->space = create_mspace(0, 0);
+  heap->remoteFrees = nullptr;
+  heap->liveBlocks = 0;
+  heap->released = false;
+  heap->nextReleased = nullptr;
+  if (heap->space == nullptr) {
+    pthread_mutex_lock(&releasedHeapsLock);
+    heap->nextReleased = spareHeaps;
+    spareHeaps = heap;
+    pthread_mutex_unlock(&releasedHeapsLock);
+    return nullptr;
+  }
+  mspace_set_user_data(heap->space, heap);
+  return heap;
+#else
+  return nullptr;
+#endif
+}
+
+void releaseHeap(void* heap) {
+#if USE_THREAD_HEAPS
+  if (heap == nullptr) return;
+  Heap* released = reinterpret_cast<Heap*>(heap);
+  if (currentHeap == released) currentHeap = nullptr;
+  pthread_mutex_lock(&releasedHeapsLock);
+  // Foreign threads, which see the flag, return blocks with the lock taken, and the ones that
+  // did not see it have already pushed their blocks, drained below.
+  __atomic_store_n(&released->released, true, __ATOMIC_SEQ_CST);
+  drainRemoteFrees(released);
+  if (released->liveBlocks == 0) {
+    released->released = false;
+    destroyHeap(released);
+  } else {
+    mspace_trim(released->space, 0);
+    released->nextReleased = releasedHeaps;
+    releasedHeaps = released;
+  }
+  pthread_mutex_unlock(&releasedHeapsLock);
+#endif
+}
+
+void setCurrentHeap(void* heap) {
+#if USE_THREAD_HEAPS
+  currentHeap = reinterpret_cast<Heap*>(heap);
+#endif
+}
+
+size_t memoryPageSize() {
+#if KONAN_NO_MMAP
+  return 4096;
+#else
+  static size_t pageSize = 0;
+  if (pageSize == 0) pageSize = ::sysconf(_SC_PAGESIZE);
+  return pageSize;
+#endif
+}
+
+void* mapMemory(size_t size) {
+#if KONAN_NO_MMAP
+  return nullptr;
+#else
+  void* result = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+  return result == MAP_FAILED ? nullptr : result;
+#endif
+}
+
+void unmapMemory(void* memory, size_t size) {
+#if !KONAN_NO_MMAP
+  ::munmap(memory, size);
+#endif
+}
+
+void adviseHugePages(void* memory, size_t size) {
+#if !KONAN_NO_MMAP && defined(MADV_HUGEPAGE)
+  ::madvise(memory, size, MADV_HUGEPAGE);
+#endif
+}
+
+// File operations.
+int openFileForWriting(const char* path) {
+#if KONAN_WASM || KONAN_ZEPHYR
+  return -1;
+#else
+  int flags = O_WRONLY | O_CREAT | O_TRUNC;
+#ifdef O_BINARY
+  flags |= O_BINARY;
+#endif
+  return ::open(path, flags, 0644);
+#endif
+}
+
+bool writeFile(int file, const void* data, size_t size) {
+#if KONAN_WASM || KONAN_ZEPHYR
+  return false;
+#else
+  const char* current = reinterpret_cast<const char*>(data);
+  while (size > 0) {
+    auto written = ::write(file, current, size);
+    if (written <= 0) return false;
+    current += written;
+    size -= written;
+  }
+  return true;
+#endif
+}
+
+void closeFile(int file) {
+#if !KONAN_WASM && !KONAN_ZEPHYR
+  ::close(file);
+#endif
+}
+
 #if KONAN_INTERNAL_NOW
 
 #ifdef KONAN_ZEPHYR
@@ -321,10 +628,6 @@ long getpagesize() {
 }
 
 #else
-void* moreCore(int size) {
-    return sbrk(size);
-}
-
 long getpagesize() {
     return sysconf(_SC_PAGESIZE);
 }
@@ -38,6 +38,15 @@ RUNTIME_NORETURN void exit(int32_t status);
 
 // Thread control.
 void onThreadExit(void (*destructor)());
+// Thread parking. waitOnAddress() blocks the thread while value at `address` equals to `expected`,
+// and may also return spuriously. wakeOnAddress() wakes up one thread waiting on `address`.
+// Where parking is not supported, waitOnAddress() just yields the processor.
+void waitOnAddress(int32_t* address, int32_t expected);
+void wakeOnAddress(int32_t* address);
+
+// Returns value of environment variable, or nullptr if it is not set, or if environment is not
+// supported on the target.
+const char* getEnv(const char* name);
 
 // String/byte operations.
 // memcpy/memmove/memcmp are not here intentionally, as frequently implemented/optimized
@@ -75,8 +84,34 @@ void *memset(void *b, int c, size_t len);
 
 // Memory operations.
 void* calloc(size_t count, size_t size);
+// Memory returned by malloc() is not zeroed.
+void* malloc(size_t size);
 void free(void* ptr);
 
+// Thread heaps. When supported, memory allocated by a thread with the current heap set
+// comes from that heap, and is allocated and freed by the thread without locking.
+// Memory freed by other threads is queued, and returned to the heap by its owner.
+// createHeap() returns nullptr if thread heaps are not supported.
+void* createHeap();
+// Heap memory may outlive the thread (i.e. frozen objects), so heap is kept for reuse.
+void releaseHeap(void* heap);
+// nullptr makes the thread allocate from the global heap.
+void setCurrentHeap(void* heap);
+
+// Memory mapping operations. mapMemory() returns zeroed pages, or nullptr if mapping
+// failed or is not supported on the target.
+size_t memoryPageSize();
+void* mapMemory(size_t size);
+void unmapMemory(void* memory, size_t size);
+// Hints OS to back given range with huge pages, if possible.
+void adviseHugePages(void* memory, size_t size);
+
+// File operations. openFileForWriting() truncates existing file, and returns
+// negative value on failure, or if files are not supported on the target.
+int openFileForWriting(const char* path);
+bool writeFile(int file, const void* data, size_t size);
+void closeFile(int file);
+
 // Time operations.
 uint64_t getTimeMillis();
 uint64_t getTimeMicros();
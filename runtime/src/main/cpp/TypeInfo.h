@@ -58,7 +58,9 @@ enum Konan_RuntimeType {
 };
 
 enum Konan_TypeFlags {
-  TF_IMMUTABLE = 1 << 0
+  TF_IMMUTABLE = 1 << 0,
+  // Instances cannot be a part of reference cycle.
+  TF_ACYCLIC = 1 << 1
 };
 
 enum Konan_MetaFlags {
@@ -0,0 +1,84 @@
+/*
+ * Copyright 2010-2018 JetBrains s.r.o.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "Porting.h"
+#include "Utils.h"
+
+namespace {
+
+// Number of attempts to take contended lock before the thread is parked.
+constexpr int kLockSpinCount = 100;
+
+uint64_t lockContended = 0;
+uint64_t lockParked = 0;
+
+inline void cpuPause() {
+#if defined(__i386__) || defined(__x86_64__)
+  __builtin_ia32_pause();
+#elif defined(__arm__) || defined(__aarch64__)
+  __asm__ __volatile__("yield");
+#endif
+}
+
+}  // namespace
+
+void AdaptiveLockSlowPath(int32_t* word) {
+  __atomic_fetch_add(&lockContended, 1, __ATOMIC_RELAXED);
+  for (int spin = 0; spin < kLockSpinCount; spin++) {
+    cpuPause();
+    if (__atomic_load_n(word, __ATOMIC_RELAXED) == 0 && __sync_bool_compare_and_swap(word, 0, 1))
+      return;
+  }
+  __atomic_fetch_add(&lockParked, 1, __ATOMIC_RELAXED);
+  // Lock is marked as having waiters, so that unlocking thread wakes one of them.
+  while (__atomic_exchange_n(word, 2, __ATOMIC_ACQUIRE) != 0)
+    konan::waitOnAddress(word, 2);
+}
+
+void AdaptiveUnlockSlowPath(int32_t* word) {
+  konan::wakeOnAddress(word);
+}
+
+void LeaveReadersSlowPath(int32_t* readers) {
+  konan::wakeOnAddress(readers);
+}
+
+void AwaitReaders(int32_t* readers) {
+  uint32_t* word = reinterpret_cast<uint32_t*>(readers);
+  uint32_t epoch = __atomic_fetch_xor(word, 1U << kReadersEpochShift, __ATOMIC_SEQ_CST) >> kReadersEpochShift;
+  int shift = kReadersCounterBits * epoch;
+  for (int spin = 0; spin < kLockSpinCount; spin++) {
+    if (((__atomic_load_n(word, __ATOMIC_SEQ_CST) >> shift) & kReadersCounterMask) == 0)
+      return;
+    cpuPause();
+  }
+  // Readers are slow, most likely preempted, so let them run. Flag tells the last of them to wake us up.
+  __atomic_fetch_or(word, kReadersWaiterBit, __ATOMIC_SEQ_CST);
+  while (true) {
+    uint32_t now = __atomic_load_n(word, __ATOMIC_SEQ_CST);
+    if (((now >> shift) & kReadersCounterMask) == 0)
+      break;
+    konan::waitOnAddress(readers, static_cast<int32_t>(now));
+  }
+  __atomic_fetch_and(word, ~kReadersWaiterBit, __ATOMIC_SEQ_CST);
+}
+
+LockStatistic GetLockStatistic() {
+  LockStatistic result = {
+    __atomic_load_n(&lockContended, __ATOMIC_RELAXED), __atomic_load_n(&lockParked, __ATOMIC_RELAXED)
+  };
+  return result;
+}
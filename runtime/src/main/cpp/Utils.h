@@ -14,24 +14,81 @@
  * limitations under the License.
  */
 
+#ifndef RUNTIME_UTILS_H
+#define RUNTIME_UTILS_H
+
 #include <cstdint>
 #include "Assert.h"
 
+// Runtime lock on a 32-bit word: 0 means unlocked, 1 locked, and 2 locked with possibly parked waiters.
+// Contended lock spins for a while, and then parks the thread, so that lock holder, which was preempted,
+// is not starved of processor time by the waiters.
+void AdaptiveLockSlowPath(int32_t* word);
+void AdaptiveUnlockSlowPath(int32_t* word);
+
+inline void AdaptiveLock(int32_t* word) {
+  if (!__sync_bool_compare_and_swap(word, 0, 1))
+    AdaptiveLockSlowPath(word);
+}
+
+inline void AdaptiveUnlock(int32_t* word) {
+  int32_t old = __atomic_exchange_n(word, 0, __ATOMIC_RELEASE);
+  RuntimeAssert(old != 0, "Unable to unlock");
+  if (old == 2)
+    AdaptiveUnlockSlowPath(word);
+}
+
+// Process-wide counters of adaptive lock acquisitions, which found the lock taken, and which had to park.
+struct LockStatistic {
+  uint64_t contended;
+  uint64_t parked;
+};
+
+LockStatistic GetLockStatistic();
+
+// Readers word of the shared location holds numbers of lock-free readers, which entered in even and odd
+// epochs, current epoch in the highest bit, and a flag of parked writer. Writer changes the epoch, and only
+// waits for readers of the previous one, so that readers entering meanwhile cannot starve it.
+constexpr int kReadersCounterBits = 15;
+constexpr uint32_t kReadersCounterMask = (1U << kReadersCounterBits) - 1;
+constexpr uint32_t kReadersWaiterBit = 1U << (2 * kReadersCounterBits);
+constexpr int kReadersEpochShift = 31;
+
+void LeaveReadersSlowPath(int32_t* readers);
+
+// Returns epoch to leave.
+inline uint32_t EnterReaders(int32_t* readers) {
+  uint32_t* word = reinterpret_cast<uint32_t*>(readers);
+  while (true) {
+    uint32_t old = __atomic_load_n(word, __ATOMIC_RELAXED);
+    uint32_t epoch = old >> kReadersEpochShift;
+    if (__sync_bool_compare_and_swap(word, old, old + (1U << (kReadersCounterBits * epoch))))
+      return epoch;
+  }
+}
+
+inline void LeaveReaders(int32_t* readers, uint32_t epoch) {
+  uint32_t now = __sync_sub_and_fetch(reinterpret_cast<uint32_t*>(readers), 1U << (kReadersCounterBits * epoch));
+  // Last reader of the epoch wakes up the writer, which could be waiting for it.
+  if ((now & kReadersWaiterBit) != 0 && ((now >> (kReadersCounterBits * epoch)) & kReadersCounterMask) == 0)
+    LeaveReadersSlowPath(readers);
+}
+
+// Waits for readers, which could have seen the value just replaced. Spins for a while, and then parks
+// the thread. Writers must be serialized.
+void AwaitReaders(int32_t* readers);
+
 class SimpleMutex {
  private:
   int32_t atomicInt = 0;
 
  public:
   void lock() {
-    while (!__sync_bool_compare_and_swap(&atomicInt, 0, 1)) {
-      // TODO: yield.
-    }
+    AdaptiveLock(&atomicInt);
   }
 
   void unlock() {
-    if (!__sync_bool_compare_and_swap(&atomicInt, 1, 0)) {
-      RuntimeAssert(false, "Unable to unlock");
-    }
+    AdaptiveUnlock(&atomicInt);
   }
 };
 
@@ -53,3 +110,5 @@ class LockGuard {
   LockGuard(const LockGuard&) = delete;
   LockGuard& operator=(const LockGuard&) = delete;
 };
+
+#endif // RUNTIME_UTILS_H
@@ -15,22 +15,22 @@
  */
 #include "Memory.h"
 #include "Types.h"
+#include "Utils.h"
 
 namespace {
 
 // TODO: an ugly hack with fixed offsets.
 constexpr int referredOffset = 0;
-constexpr int lockOffset = sizeof(void*);
+constexpr int readersOffset = sizeof(void*);
 
-#if !KONAN_NO_THREADS
-
-inline void lock(int32_t* address) {
-    while (__sync_val_compare_and_swap(address, 0, 1) == 1);
+inline ObjHeader** referredAddress(ObjHeader* counter) {
+  return reinterpret_cast<ObjHeader**>(reinterpret_cast<char*>(counter + 1) + referredOffset);
 }
 
-inline void unlock(int32_t* address) {
-    int old = __sync_val_compare_and_swap(address, 1, 0);
-    RuntimeAssert(old == 1, "Incorrect lock state");
+#if !KONAN_NO_THREADS
+
+inline int32_t* readersAddress(ObjHeader* counter) {
+  return reinterpret_cast<int32_t*>(reinterpret_cast<char*>(counter + 1) + readersOffset);
 }
 
 #endif
@@ -45,14 +45,24 @@ OBJ_GETTER(makeObjCWeakReferenceImpl, void*);
 // See Weak.kt for implementation details.
 // Retrieve link on the counter object.
 OBJ_GETTER(Konan_getWeakReferenceImpl, ObjHeader* referred) {
-  MetaObjHeader* meta = referred->meta_object();
-
 #if KONAN_OBJC_INTEROP
   if (IsInstance(referred, theObjCObjectWrapperTypeInfo)) {
-    RETURN_RESULT_OF(makeObjCWeakReferenceImpl, meta->associatedObject_);
+    RETURN_RESULT_OF(makeObjCWeakReferenceImpl, referred->meta_object()->associatedObject_);
   }
 #endif // KONAN_OBJC_INTEROP
 
+  if (!referred->has_meta_object()) {
+    // Fast path: counter is stored to the new meta-object before it is published, so both are set up at once.
+    ObjHolder counterHolder;
+    ObjHeader* counter = makeWeakReferenceCounter(reinterpret_cast<void*>(referred), counterHolder.slot());
+    MetaObjHeader* meta = ObjHeader::createMetaObject(&referred->typeInfoOrMeta_, counter);
+    // Meta-object could be installed concurrently, without a counter.
+    if (meta->counter_ == nullptr)
+      UpdateRefIfNull(&meta->counter_, counter);
+    RETURN_OBJ(meta->counter_);
+  }
+
+  MetaObjHeader* meta = referred->meta_object();
   if (meta->counter_ == nullptr) {
      ObjHolder counterHolder;
      // Cast unneeded, just to emphasize we store an object reference as void*.
@@ -63,31 +73,37 @@ OBJ_GETTER(Konan_getWeakReferenceImpl, ObjHeader* referred) {
 }
 
 // Materialize a weak reference to either null or the real reference.
+// Readers do not block each other: reader announces itself in the counter, and only takes reference,
+// if the object is not being freed already. Clearing thread waits for readers announced before it,
+// so that the object stays in place while they look at it, see WeakReferenceCounterClear().
 OBJ_GETTER(Konan_WeakReferenceCounter_get, ObjHeader* counter) {
-  ObjHeader** referredAddress = reinterpret_cast<ObjHeader**>(reinterpret_cast<char*>(counter + 1) + referredOffset);
 #if KONAN_NO_THREADS
-  RETURN_OBJ(*referredAddress);
+  RETURN_OBJ(*referredAddress(counter));
 #else
-  int32_t* lockAddress = reinterpret_cast<int32_t*>(reinterpret_cast<char*>(counter + 1) + lockOffset);
-  // Spinlock.
-  lock(lockAddress);
-  ObjHolder holder(*referredAddress);
-  unlock(lockAddress);
+  int32_t* readers = readersAddress(counter);
+  uint32_t epoch = EnterReaders(readers);
+  ObjHeader* referred = __atomic_load_n(referredAddress(counter), __ATOMIC_SEQ_CST);
+  if (referred != nullptr && !TryAddRef(referred))
+    referred = nullptr;
+  LeaveReaders(readers, epoch);
+  if (referred == nullptr)
+    RETURN_OBJ(nullptr);
+  ObjHolder holder;
+  // Adopt reference taken above.
+  *holder.slot() = referred;
   RETURN_OBJ(holder.obj());
 #endif
 }
 
 void WeakReferenceCounterClear(ObjHeader* counter) {
-  ObjHeader** referredAddress = reinterpret_cast<ObjHeader**>(reinterpret_cast<char*>(counter + 1) + referredOffset);
   // Note, that we don't do UpdateRef here, as reference is weak.
 #if KONAN_NO_THREADS
-  *referredAddress = nullptr;
+  *referredAddress(counter) = nullptr;
 #else
-  int32_t* lockAddress = reinterpret_cast<int32_t*>(reinterpret_cast<char*>(counter + 1) + lockOffset);
-  // Spinlock.
-  lock(lockAddress);
-  *referredAddress = nullptr;
-  unlock(lockAddress);
+  __atomic_store_n(referredAddress(counter), nullptr, __ATOMIC_SEQ_CST);
+  // Readers may have seen the object before it was cleared, but cannot take reference to it.
+  // Readers coming later only see null, so they are not waited for, and cannot starve this thread.
+  AwaitReaders(readersAddress(counter));
 #endif
 }
 
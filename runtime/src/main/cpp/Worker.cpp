@@ -370,20 +370,25 @@ void* workerRoutine(void* argument) {
       theState()->removeWorkerUnlocked(worker->id());
       break;
     }
-    ObjHolder argumentHolder;
-    KRef argument = AdoptStablePointer(job.argument, argumentHolder.slot());
-    // Note that this is a bit hacky, as we must not auto-release resultRef,
-    // so we don't use ObjHolder.
-    // It is so, as ownership is transferred.
-    KRef resultRef = nullptr;
     KNativePtr result = nullptr;
-    try {
-        job.function(argument, &resultRef);
-        // Transfer the result.
-        result = transfer(resultRef, job.transferMode);
-    } catch (ObjHolder& e) {
-        ReportUnhandledException(e.obj());
+    {
+      ObjHolder argumentHolder;
+      KRef argument = AdoptStablePointer(job.argument, argumentHolder.slot());
+      // Note that this is a bit hacky, as we must not auto-release resultRef,
+      // so we don't use ObjHolder.
+      // It is so, as ownership is transferred.
+      KRef resultRef = nullptr;
+      try {
+          job.function(argument, &resultRef);
+          // Transfer the result.
+          result = transfer(resultRef, job.transferMode);
+      } catch (ObjHolder& e) {
+          ReportUnhandledException(e.obj());
+      }
     }
+    // Worker may wait for the next job for long, so frozen objects released by this one
+    // are freed before the future is notified.
+    FlushFrozenReleases();
     // Notify the future.
     job.future->storeResultUnlocked(result);
   }
@@ -531,12 +531,19 @@ MAX_RELEASE_CHECK_RATE   default: 4095 unless not HAVE_MMAP
 #define NO_MALLOC_STATS 1
 #define HAVE_MMAP 0 // don't try to allocate large chunks of memory using mmap().
                     // It will go to malloc->calloc->sbrk->morecore chain anyways.
+#define HAVE_MORECORE 1
+#define MORECORE konan::moreCore
 #else
 #define USE_LOCKS 1
+// System allocator of the process may use sbrk() as well, so only map memory.
+#define HAVE_MORECORE 0
+#endif
+#if KONAN_THREAD_HEAPS && !KONAN_NO_THREADS
+// Per-thread heaps, see konan::createHeap(). Footers let free() find the space owning a chunk.
+#define MSPACES 1
+#define FOOTERS 1
 #endif
 #define DLMALLOC_EXPORT extern "C"
-#define HAVE_MORECORE 1
-#define MORECORE konan::moreCore
 #define malloc_getpagesize konan::getpagesize()
 namespace konan {
 extern void* moreCore(int size);
@@ -1436,6 +1443,16 @@ DLMALLOC_EXPORT int mspace_trim(mspace msp, size_t pad);
 */
 DLMALLOC_EXPORT int mspace_mallopt(int, int);
 
+#if FOOTERS
+/*
+  Konan-specific: mspace_set_user_data attaches an arbitrary pointer to
+  the space, and mspace_user_data_of returns the pointer attached to the
+  space owning the given chunk, or 0 if chunk belongs to the global heap.
+*/
+DLMALLOC_EXPORT void mspace_set_user_data(mspace msp, void* data);
+DLMALLOC_EXPORT void* mspace_user_data_of(const void* mem);
+#endif /* FOOTERS */
+
 #endif /* MSPACES */
 
 #ifdef __cplusplus
@@ -5990,6 +6007,27 @@ int mspace_mallopt(int param_number, int value) {
   return change_mparam(param_number, value);
 }
 
+#if FOOTERS
+void mspace_set_user_data(mspace msp, void* data) {
+  mstate ms = (mstate)msp;
+  if (!ok_magic(ms)) {
+    USAGE_ERROR_ACTION(ms,ms);
+    return;
+  }
+  ms->extp = data;
+}
+
+void* mspace_user_data_of(const void* mem) {
+  mchunkptr p = mem2chunk(mem);
+  mstate fm = get_mstate_for(p);
+  if (!ok_magic(fm)) {
+    USAGE_ERROR_ACTION(fm, p);
+    return 0;
+  }
+  return fm->extp;
+}
+#endif /* FOOTERS */
+
 #endif /* MSPACES */
 
 
@@ -65,4 +65,132 @@ object GC {
 
     @SymbolName("Kotlin_konan_internal_GC_setThreshold")
     private external fun setThreshold(value: Int)
-}
\ No newline at end of file
+
+    // Pause budget of collections triggered by the threshold, in microseconds. If positive, such collections
+    // stop once the budget is exhausted and leave remaining cycle candidates to the following collections, so
+    // that long pauses are split into shorter ones. Candidates, whose subgraphs cannot be traversed within the budget,
+    // are set aside until there are 64 of them, and then collected by single non-incremental collection.
+    // Zero (the default) means collections process all candidates. Explicit collect() is never limited.
+    var pauseBudgetMicros: Int
+        get() = getPauseBudget()
+        set(value) = setPauseBudget(value)
+
+    @SymbolName("Kotlin_konan_internal_GC_getPauseBudget")
+    private external fun getPauseBudget(): Int
+
+    @SymbolName("Kotlin_konan_internal_GC_setPauseBudget")
+    private external fun setPauseBudget(value: Int)
+
+    // Number of bytes in heap objects of all threads.
+    val heapBytes: Long
+        get() = getHeapBytes()
+
+    // Process-wide soft heap limit in bytes, zero means no limit. Once the heap grows over it, threads
+    // collect garbage after allocating their share of the limit, so that the heaviest allocators collect first.
+    // Initially taken from KONAN_HEAP_SOFT_LIMIT environment variable, with optional K, M or G suffix.
+    var heapSoftLimit: Long
+        get() = getHeapSoftLimit()
+        set(value) = setHeapSoftLimit(value)
+
+    // Process-wide hard heap limit in bytes, zero means no limit. Allocation, which would exceed it even
+    // after garbage collection, throws OutOfMemoryError. Initially taken from KONAN_HEAP_HARD_LIMIT
+    // environment variable.
+    var heapHardLimit: Long
+        get() = getHeapHardLimit()
+        set(value) = setHeapHardLimit(value)
+
+    @SymbolName("Kotlin_konan_internal_GC_getHeapBytes")
+    private external fun getHeapBytes(): Long
+
+    @SymbolName("Kotlin_konan_internal_GC_getHeapSoftLimit")
+    private external fun getHeapSoftLimit(): Long
+
+    @SymbolName("Kotlin_konan_internal_GC_setHeapSoftLimit")
+    private external fun setHeapSoftLimit(value: Long)
+
+    @SymbolName("Kotlin_konan_internal_GC_getHeapHardLimit")
+    private external fun getHeapHardLimit(): Long
+
+    @SymbolName("Kotlin_konan_internal_GC_setHeapHardLimit")
+    private external fun setHeapHardLimit(value: Long)
+
+    // If memory manager statistics of the current thread is collected. Collection adds small overhead
+    // to every allocation and reference update, so it is disabled by default.
+    var collectStatistics: Boolean
+        get() = getCollectStatistics()
+        set(value) = setCollectStatistics(value)
+
+    // Snapshot of memory manager statistics of the current thread as JSON string, containing
+    // allocations per type, allocation size histogram, reference updates per container kind,
+    // heap and arena allocated bytes, freeze counts, and process-wide counts of contended and parked
+    // acquisitions of runtime locks.
+    @SymbolName("Kotlin_konan_internal_GC_statistics")
+    external fun statistics(): String
+
+    // Reset all statistics counters of the current thread.
+    @SymbolName("Kotlin_konan_internal_GC_resetStatistics")
+    external fun resetStatistics()
+
+    // Write objects of the current thread reachable from global variables, objects and local variables
+    // with their types, containers and references to the file at [path], in binary format described
+    // in Memory.cpp. Returns false if the file cannot be written.
+    @SymbolName("Kotlin_konan_internal_GC_dumpHeap")
+    external fun dumpHeap(path: String): Boolean
+
+    // Start sampling allocation profiler for all threads. On average one sample is taken per
+    // [samplingIntervalBytes] of allocated memory, and samples collected so far are discarded.
+    @SymbolName("Kotlin_konan_internal_GC_startAllocationProfiling")
+    external fun startAllocationProfiling(samplingIntervalBytes: Int = 512 * 1024)
+
+    // Stop sampling allocation profiler, keeping collected samples.
+    @SymbolName("Kotlin_konan_internal_GC_stopAllocationProfiling")
+    external fun stopAllocationProfiling()
+
+    // Write allocation samples to the file at [path] in pprof format. Returns false if the file cannot be written.
+    @SymbolName("Kotlin_konan_internal_GC_writeAllocationProfile")
+    external fun writeAllocationProfile(path: String): Boolean
+
+    // Recent garbage collections of the current thread, oldest first. Only last 128 collections are kept.
+    fun collectionEvents(): List<GCEvent> {
+        val fields = getCollectionEvents()
+        return List(fields.size / 7) {
+            val base = it * 7
+            GCEvent(fields[base], fields[base + 1], fields[base + 2].toInt(), fields[base + 3].toInt(),
+                    fields[base + 4].toInt(), fields[base + 5].toInt(), fields[base + 6] != 0L)
+        }
+    }
+
+    // Recent garbage collections of the current thread in Chrome trace event format, suitable for
+    // chrome://tracing or Perfetto. Events are attributed to thread [threadId].
+    fun collectionTrace(threadId: Int = 0): String {
+        val result = StringBuilder("{\"traceEvents\":[")
+        collectionEvents().forEachIndexed { index, event ->
+            if (index > 0) result.append(',')
+            result.append("{\"name\":\"GC\",\"cat\":\"gc\",\"ph\":\"X\",\"pid\":0,\"tid\":").append(threadId)
+                    .append(",\"ts\":").append(event.startTimeMicros)
+                    .append(",\"dur\":").append(event.durationMicros)
+                    .append(",\"args\":{\"toFree\":").append(event.toFreeSize)
+                    .append(",\"roots\":").append(event.rootsSize)
+                    .append(",\"freed\":").append(event.freedContainers)
+                    .append(",\"threshold\":").append(event.threshold)
+                    .append(",\"incremental\":").append(event.incremental)
+                    .append("}}")
+        }
+        return result.append("]}").toString()
+    }
+
+    @SymbolName("Kotlin_konan_internal_GC_getCollectionEvents")
+    private external fun getCollectionEvents(): LongArray
+
+    @SymbolName("Kotlin_konan_internal_GC_getCollectStatistics")
+    private external fun getCollectStatistics(): Boolean
+
+    @SymbolName("Kotlin_konan_internal_GC_setCollectStatistics")
+    private external fun setCollectStatistics(value: Boolean)
+}
+
+// Single garbage collection: when it started and how long it took, number of release candidates
+// and possible cycle roots it examined, number of containers it freed, GC threshold after it, and
+// if it was limited by pause budget.
+data class GCEvent(val startTimeMicros: Long, val durationMicros: Long, val toFreeSize: Int,
+                   val rootsSize: Int, val freedContainers: Int, val threshold: Int, val incremental: Boolean)
@@ -39,14 +39,16 @@ import konan.internal.NoReorderFields
  *   References from weak reference objects to the counter and from the metaobject to the counter are strong,
  *  and from the counter to the object is nullably weak. So whenever an object dies, if it has a metaobject,
  *  it is traversed to find a counter object, and atomically nullify reference to the object. Afterward, all attempts
- *  to get the object would yield null.
+ *  to get the object would yield null. Getting the object takes no locks: reference is only added to the object,
+ *  if its counter is not zero yet, and the dying object is kept in place until such attempts are finished.
  */
 
 // Clear holding the counter object, which refers to the actual object.
 @NoReorderFields
 internal class WeakReferenceCounter(var referred: COpaquePointer?) : WeakReferenceImpl() {
-    // Spinlock, potentially taken when materializing or removing 'referred' object.
-    var lock: Int = 0
+    // Numbers of threads currently materializing 'referred' object in two epochs, awaited when it is removed,
+    // see EnterReaders() in Utils.h.
+    var readers: Int = 0
 
     @SymbolName("Konan_WeakReferenceCounter_get")
     external override fun get(): Any?
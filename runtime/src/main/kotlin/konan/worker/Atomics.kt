@@ -126,8 +126,10 @@ external private fun checkIfFrozen(ref: Any?)
 @Frozen
 @NoReorderFields
 class AtomicReference<T>(private var value: T? = null) {
-    // A spinlock to fix potential ARC race. Not an AtomicInt just for the effeciency sake.
+    // A lock serializing compareAndSwap() calls. Not an AtomicInt just for the effeciency sake.
     private var lock: Int = 0
+    // Readers in progress, so that replaced value is not released under them, see Atomic.cpp.
+    private var readers: Int = 0
 
     /**
      * Creates a new atomic reference pointing to given [ref]. If reference is not frozen,